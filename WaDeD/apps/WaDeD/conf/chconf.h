@@ -494,10 +494,20 @@
  */
 #if !defined(IDLE_LOOP_HOOK) || defined(__DOXYGEN__)
 #define IDLE_LOOP_HOOK() {                                                  \
-  /* Idle loop code here.*/                                                 \
+  extern void power_idle(void);                                             \
+  power_idle();                                                             \
 }
 #endif
 
+/**
+ * @brief   Stack of the idle thread.
+ * @details The virtual timers missed in stop mode are fired from the idle
+ *          thread, see power.c.
+ */
+#if !defined(PORT_IDLE_THREAD_STACK_SIZE) || defined(__DOXYGEN__)
+#define PORT_IDLE_THREAD_STACK_SIZE     128
+#endif
+
 /**
  * @brief   System tick event hook.
  * @details This hook is invoked in the system tick handler immediately
@@ -30,6 +30,9 @@
 #include "memory.h"
 #include "bucket.h"
 #include "usb_thread.h"
+#include "radio.h"
+#include "channel.h"
+#include "power.h"
 
 #define NO_LED
 
@@ -43,14 +46,13 @@
 #define usb_puts(...)
 #endif
 
-#define MAX_SIZE_MSG 164
+#define MAX_SIZE_MSG PACKET_MAX_SIZE
 
 #ifdef RADIO_TEST
 static char tx_buffer[MAX_SIZE_MSG];
 #endif
 
 int DEVICE_ID = 2;
-static char rx_buffer[MAX_SIZE_MSG];
 
 #define RX_MIN_TIMEOUT  MS2ST(500)
 #define RX_RAND_MAX     MS2ST(2000)
@@ -61,6 +63,93 @@ static inline uint32_t rand32(uint32_t max)
     return (uint32_t) (max * ((float) rand() / (float) (RAND_MAX)));
 }
 
+/**
+ * @brief Get the contention class of a packet.
+ *
+ * @param type The type of the packet.
+ *
+ * @return RADIO_CLASS
+ */
+static int tx_class(uint8_t type)
+{
+    switch (type) {
+        case OFFER:
+        case ACCEPT:
+        case ACK:
+        case SINCE:
+            return RADIO_URGENT;
+        case MESSAGE:
+        case DATA:
+            return RADIO_BULK;
+        default:
+            return RADIO_NORMAL;
+    }
+}
+
+/**
+ * @brief Event waking the transmit thread up once a packet has been handled.
+ */
+#define TX_WAKE_MASK EVENT_MASK(0)
+
+static Thread *tx_tp;
+
+static WORKING_AREA(WA_tx, 768);
+
+/**
+ * @brief Prepare the packets to send and hand them to the radio thread, while
+ * the main thread handles the packets received.
+ */
+static msg_t tx_thread(void *arg)
+{
+    (void) arg;
+    int state = TX_SUCCESS;
+
+    for(;;) {
+        // Transmit the current message in the tx_buffer if the previous
+        // transmission attempt failed.
+        // If the previous transmission was a success, we call fifo_pop to
+        // have the next one. If their is a new message in tx_buffer, fifo_pop
+        // return 1.
+        int ready = (state == CHANNEL_BUSY);
+        if (!ready) {
+            jungle_lock();
+            ready = fifo_pop();
+            jungle_unlock();
+        }
+
+        if (!ready) {
+            // Nothing to send until a packet has been handled, or a period
+            // has elapsed.
+            chEvtWaitAnyTimeout(TX_WAKE_MASK,
+                                RX_MIN_TIMEOUT + rand32(RX_RAND_MAX));
+            continue;
+        }
+
+#ifndef NO_USB
+        usb_puts("Transmitting\n");
+#endif
+        uint8_t type = tx_buffer[0] & 0x0F;
+        int session  = type == DATA || type == ACK;
+        state = radio_send(tx_buffer[1] + HEADER_SIZE, fifo_tx_fill,
+                           tx_class(type), session);
+        jungle_lock();
+        channel_sent(session);
+        jungle_unlock();
+#ifndef NO_USB
+        if (state == CHANNEL_BUSY)
+            usb_puts("TX busy\n");
+        else
+            usb_printf("Message transmitted type: %d - %d\n",
+                            tx_buffer[0], tx_buffer[2]);
+#endif
+        // Leave the channel to the others before trying again.
+        if (state == CHANNEL_BUSY)
+            chThdSleep(RX_MIN_TIMEOUT + rand32(RX_RAND_MAX));
+    }
+
+    return 0;
+}
+
 int main(void)
 {
     halInit();
@@ -69,63 +158,52 @@ int main(void)
     usb_init();
     sx_init();
     dash7_init();
-    dio_init();
+    power_init();
 #ifndef NO_LED
     led_init();
 #endif
     chThdSleepSeconds(3);
 
     tree_reset();
+    jungle_init();
     usb_printf("GO!\n");
 
     srand((uint32_t) chTimeNow());
-    int state = TX_SUCCESS;
-    ssize_t size = 0;
+    struct Packet *rx;
 
     usb_thread_init();
+    radio_init();
+    tx_tp = chThdCreateStatic(WA_tx, sizeof WA_tx, NORMALPRIO, tx_thread,
+                              NULL);
 
     for(;;) {
-        usb_puts("Receiving\n");
-        size = receive_packet(rx_buffer,
-                              sizeof rx_buffer,
-                              RX_MIN_TIMEOUT + rand32(RX_RAND_MAX));
+        // The radio listens all along, and reports each packet as soon as it
+        // is received, while the previous one is still being handled.
+        if (radio_wait(TIME_INFINITE, &rx) != RADIO_RECEIVED)
+            continue;
 
-        if (size == TIMEOUT) {
-            usb_puts("RX Timeout\n");
-        } else if (size == RECEIVE_CRC_ERROR) {
+        if (rx->size == RECEIVE_CRC_ERROR) {
             usb_puts("RX Timeout\n");
-        } else if (size == RECEIVE_TOO_LONG) {
+        } else if (rx->size == RECEIVE_TOO_LONG) {
             usb_puts("ERROR Too long\n");
+        } else if (rx->size == RECEIVE_DROPPED) {
+            usb_puts("RX Known message\n");
+            jungle_lock();
+            handle_dropped(rx);
+            jungle_unlock();
         } else {
-            usb_printf("Message received type: %d - %d\n", rx_buffer[0],
-                            rx_buffer[2]);
-            handle_packet(rx_buffer);
+            usb_printf("Message received type: %d - %d\n",
+                            packet_data(rx)[0], packet_data(rx)[2]);
+            jungle_lock();
+            handle_packet(rx);
+            jungle_unlock();
             extern uint16_t memory_counter;
             usb_printf("memory_counter = %d\n", memory_counter);
         }
+        packet_release(rx);
 
-        // TODO: Check if the handle packet running time is enough
-        // or if we really need this pause.
-        chThdSleepMilliseconds(10);
-
-        // Transmit the current message in the tx_buffer if the previous
-        // transmission attempt failed.
-        // If the previous transmission was a success, we call fifo_pop to
-        // have the next one. If their is a new message in tx_buffer, fifo_pop
-        // return 1.
-        if (state == CHANNEL_BUSY || (state == TX_SUCCESS && fifo_pop())) {
-#ifndef NO_USB
-            usb_puts("Transmitting\n");
-#endif
-            state = send_packet(tx_buffer, tx_buffer[1] + 2, TIME_IMMEDIATE);
-#ifndef NO_USB
-            if (state == CHANNEL_BUSY)
-                usb_puts("TX busy\n");
-            else
-                usb_printf("Message transmitted type: %d - %d\n",
-                                tx_buffer[0], tx_buffer[2]);
-#endif
-        }
+        // The packet may have queued answers.
+        chEvtSignal(tx_tp, TX_WAKE_MASK);
 #ifndef NO_LED
         led_toggle();
 #endif
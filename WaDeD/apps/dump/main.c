@@ -38,7 +38,7 @@
 #include "bucket.h"
 #include "usb_thread.h"
 
-#define MAX_SIZE_MSG 164
+#define MAX_SIZE_MSG PACKET_MAX_SIZE
 
 #ifdef RADIO_TEST
 static char tx_buffer[MAX_SIZE_MSG];
@@ -61,15 +61,15 @@ static void dump_node(const void *buf)
 {
     usb_printf("NODE %d\n"
             "sons: %x %x %x %x %x %x %x %x",
-            ((uint8_t *) buf)[2] & 0x0F,
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[1],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[2],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[3],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[4],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[5],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[6],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[7],
-            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 3))[8]);
+            ((uint8_t *) buf)[0] & 0x0F,
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[1],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[2],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[3],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[4],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[5],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[6],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[7],
+            (uint32_t) ((uint64_t *) ((uint8_t *) buf + 1))[8]);
 }
 
 static void dump_root(const void *buf)
@@ -105,6 +105,8 @@ void dump_packet(const void *buf)
     uint8_t version = ((uint8_t *) buf)[0] >> 4;
     uint8_t type    = ((uint8_t *) buf)[0] & 0x0F;
     uint8_t length  = ((uint8_t *) buf)[1];
+    uint16_t source = ((uint16_t *) buf)[1];
+    const uint8_t *body = ((uint8_t *) buf) + HEADER_SIZE;
 
     usb_printf(
 #ifndef __TAG_MODE__
@@ -113,22 +115,31 @@ void dump_packet(const void *buf)
             "device %d "
 #endif
             "length %d "
+            "source %x "
             "type ",
             version,
-            length);
+            length,
+            source);
 
     switch(type) {
         case(NODE):
-            dump_node(((uint8_t *) buf));
+            dump_node(body);
             break;
         case(ROOT):
-            dump_root(((uint8_t *) buf) + 2);
+            dump_root(body);
             break;
         case(LEAF):
-            dump_list(((uint8_t *) buf) + 2);
+            dump_list(body);
             break;
         case(MESSAGE):
-            dump_message(((uint8_t *) buf) + 2);
+            dump_message(body);
+            break;
+        case(DATA):
+            usb_printf("DATA to %x seq %d\n", ((uint16_t *) body)[0], body[2]);
+            dump_message(body + DATA_HEADER_SIZE);
+            break;
+        default:
+            usb_printf("%d to %x", type, ((uint16_t *) body)[0]);
             break;
     }
 }
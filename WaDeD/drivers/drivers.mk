@@ -19,10 +19,12 @@
 DRIVERSSRC =  ${DRIVERS}/fram/fram.c   \
   					  ${DRIVERS}/sx1231/sx1231.c \
 						  ${DRIVERS}/led/led.c \
-							${DRIVERS}/usb/waded_usb.c
+							${DRIVERS}/usb/waded_usb.c \
+							${DRIVERS}/stm32l/standby_mode.c
 
 # Required include directories
 DRIVERSINC =  ${DRIVERS}/fram \
 							${DRIVERS}/sx1231 \
 						  ${DRIVERS}/led \
-						  ${DRIVERS}/usb
+						  ${DRIVERS}/usb \
+						  ${DRIVERS}/stm32l
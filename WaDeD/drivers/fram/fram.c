@@ -42,9 +42,79 @@
 // Set when we have put the FRAM in sleep mode
 static volatile int sleep_mode = 1;
 
+// Set while the SLEEP op-code sent after a quiet period is in progress.
+static volatile int falling_asleep = 0;
+static SEMAPHORE_DECL(asleep, 0);
+
+// Set while a read started by fram_read_start is in progress.
+static volatile int async_pending = 0;
+static SEMAPHORE_DECL(async_done, 0);
+
+// Armed at the end of each transaction, puts the FRAM in sleep mode when it
+// fires.
+static VirtualTimer quiet;
+
+static const uint8_t sleep_opcode = SLEEP;
+
+static struct FramStats stats;
+static systime_t asleep_since = 0;
+
+/**
+ * @brief Account for the FRAM falling asleep. Call with the system locked.
+ */
+static void fell_asleep(void)
+{
+    sleep_mode = 1;
+    asleep_since = chTimeNow();
+}
+
+/**
+ * @brief Called at the end of each transfer, signals the end of the
+ * asynchronous reads, and of the SLEEP op-code sent by quiet_elapsed.
+ *
+ * @param spip The SPI driver.
+ */
+static void transfer_done(SPIDriver *spip)
+{
+    if (falling_asleep) {
+        chSysLockFromIsr();
+        spiUnselectI(spip);
+        falling_asleep = 0;
+        fell_asleep();
+        chSemResetI(&asleep, 0);
+        chSysUnlockFromIsr();
+    } else if (async_pending) {
+        chSysLockFromIsr();
+        chSemSignalI(&async_done);
+        chSysUnlockFromIsr();
+    }
+}
+
+/**
+ * @brief Put the FRAM in sleep mode once it has not been used for
+ * FRAM_QUIET_TIME.
+ *
+ * @note  The timer is only armed while no transaction is in progress, the
+ * SLEEP op-code is thus sent from here without taking the bus. A transaction
+ * starting meanwhile waits for its end in start_spi.
+ *
+ * @param par Unused.
+ */
+static void quiet_elapsed(void *par)
+{
+    (void) par;
+    chSysLockFromIsr();
+    if (!sleep_mode && (SPI_FRAM)->state == SPI_READY) {
+        falling_asleep = 1;
+        spiSelectI(SPI_FRAM);
+        spiStartSendI(SPI_FRAM, sizeof sleep_opcode, &sleep_opcode);
+    }
+    chSysUnlockFromIsr();
+}
+
 // Maximum speed SPI configuration (16MHz, CPHA=0, CPOL=0, MSb first).
 static const SPIConfig spi_cfg_fram = {
-    NULL,
+    transfer_done,
     GPIOB,
     12,
     0
@@ -58,6 +128,16 @@ static const SPIConfig spi_cfg_fram = {
 static int start_spi(void)
 {
     spiAcquireBus(SPI_FRAM);
+    chSysLock();
+    if (chVTIsArmedI(&quiet))
+        chVTResetI(&quiet);
+    if (falling_asleep)
+        chSemWaitS(&asleep);
+    if (sleep_mode) {
+        stats.wakeups++;
+        stats.asleep += chTimeNow() - asleep_since;
+    }
+    chSysUnlock();
     spiSelect(SPI_FRAM);
     if (sleep_mode) {
         chThdSleepMicroseconds(400);
@@ -74,6 +154,11 @@ static int start_spi(void)
 static int end_spi(void)
 {
     spiUnselect(SPI_FRAM);
+    // The operations which follow within the quiet time share the wake-up.
+    chSysLock();
+    if (!sleep_mode)
+        chVTSetI(&quiet, FRAM_QUIET_TIME, quiet_elapsed, NULL);
+    chSysUnlock();
     spiReleaseBus(SPI_FRAM);
     return 0;
 }
@@ -104,15 +189,20 @@ static inline uint8_t spi_receive8(void)
 }
 
 /**
- * @brief Send the address we want to reach to the FRAM.
+ * @brief Send an op-code and the address it applies to, in a single transfer.
  *
+ * @param opcode  The op-code.
  * @param addr    The address.
  */
-static inline void spi_send_address(uint32_t addr)
+static inline void spi_send_command(uint8_t opcode, uint32_t addr)
 {
-    spi_send8((addr >> 16) & 3);
-    spi_send8(addr >> 8);
-    spi_send8(addr);
+    uint8_t command [4] = {
+        opcode,
+        (addr >> 16) & 3,
+        addr >> 8,
+        addr
+    };
+    spi_send(command, sizeof command);
 }
 
 /**
@@ -140,13 +230,38 @@ void fram_read(uint32_t address, void *buffer, size_t size)
 {
     SPITRANSACTION {
         // Send command
-        spi_send8(READ);
-        spi_send_address(address);
+        spi_send_command(READ, address);
         // Receive Data
         spi_receive(buffer, size);
     }
 }
 
+/**
+ * @brief Start reading in burst on the fram, without waiting for the end of
+ * the transfer.
+ *
+ * @param address    The address where to start to read.
+ * @param buffer     The buffer to store the data.
+ * @param size       The size of what we want to read.
+ */
+void fram_read_start(uint32_t address, void *buffer, size_t size)
+{
+    start_spi();
+    spi_send_command(READ, address);
+    async_pending = 1;
+    spiStartReceive(SPI_FRAM, size, buffer);
+}
+
+/**
+ * @brief Wait for the end of the read started by fram_read_start.
+ */
+void fram_read_wait(void)
+{
+    chSemWait(&async_done);
+    async_pending = 0;
+    end_spi();
+}
+
 /**
  * @brief Write in burst on the fram.
  *
@@ -160,8 +275,7 @@ void fram_write(uint32_t address, const void *buffer, size_t size)
         spi_send8(WREN);
     SPITRANSACTION {
         // Send command
-        spi_send8(WRITE);
-        spi_send_address(address);
+        spi_send_command(WRITE, address);
         // Send data
         spi_send(buffer, size);
     }
@@ -175,11 +289,22 @@ void fram_sleep(void)
     if (!sleep_mode) {
         SPITRANSACTION {
             spi_send8(SLEEP);
-            sleep_mode = 1;
+            chSysLock();
+            fell_asleep();
+            chSysUnlock();
         }
     }
 }
 
+void fram_stats(struct FramStats *s)
+{
+    chSysLock();
+    *s = stats;
+    if (sleep_mode)
+        s->asleep += chTimeNow() - asleep_since;
+    chSysUnlock();
+}
+
 /**
  * @brief  Read the status register of the FRAM.
  *
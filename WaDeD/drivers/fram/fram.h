@@ -28,6 +28,26 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include "ch.h"
+
+/**
+ * @brief Time without any access after which the FRAM is put in sleep mode.
+ *
+ * Waking it up costs 400us, the accesses which follow each other within this
+ * time share a single wake-up.
+ */
+#ifndef FRAM_QUIET_TIME
+#define FRAM_QUIET_TIME MS2ST(20)
+#endif
+
+/**
+ * @brief Sleep mode statistics since boot.
+ */
+struct FramStats {
+    uint32_t  wakeups;
+    systime_t asleep; // Time spent in sleep mode, in ticks.
+};
+
 // Basic low level communication functions.
 // All other fram interaction functions or macros use only those two.
 
@@ -118,6 +138,28 @@ void fram_write32(uint32_t address, uint32_t data);
 void fram_write64(uint32_t address, uint64_t data);
 
 
+#ifndef __SIMU__
+/**
+ * @brief Start reading in burst on the fram, without waiting for the end of
+ * the transfer, so that something else can be done meanwhile.
+ *
+ * @note The FRAM cannot be accessed otherwise until fram_read_wait is called.
+ *
+ * @param address    The address where to start to read.
+ * @param buffer     The buffer to store the data.
+ * @param size       The size of what we want to read.
+ */
+void fram_read_start(uint32_t address, void *buffer, size_t size);
+
+/**
+ * @brief Wait for the end of the read started by fram_read_start.
+ */
+void fram_read_wait(void);
+#else
+#define fram_read_start(address, buffer, size) fram_read(address, buffer, size)
+#define fram_read_wait()
+#endif // __SIMU__
+
 /**
  * @brief  Read the status register of the FRAM.
  *
@@ -134,9 +176,19 @@ void fram_rdid(uint8_t content[9]);
 
 /**
  * @brief Put the FRAM in sleep mode.
+ *
+ * @note  The FRAM falls asleep by itself FRAM_QUIET_TIME after its last
+ * access.
  */
 void fram_sleep(void);
 
+/**
+ * @brief Get the sleep mode statistics of the FRAM.
+ *
+ * @param stats Filled with the statistics.
+ */
+void fram_stats(struct FramStats *stats);
+
 /**
  * @brief Initialise the SPI for the FRAM.
  */
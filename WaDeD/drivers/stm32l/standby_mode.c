@@ -17,98 +17,116 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "ch.h"
+#include "hal.h"
 #include "standby_mode.h"
-/* WATCH DOG */
-//IWDG base = 0x40003000 - 0x400033FF
-
-//key register
-//address offset 0x00
-//reset value 0x00000000
-#define IWDG_KR (*(volatile uint16_t*)(0x40003000))
-//values
-#define WD_RLOAD 0xAAAA
-#define WD_START 0xCCCC
-#define WD_ACCESS 0x5555
-
-#define SET_WD_RLOAD (IWDG_KR = WD_RLOAD)
-#define SET_WD_START (IWDG_KR = WD_START)
-#define SET_WD_ACCESS (IWDG_KR = WD_ACCESS)
-
-//prescaler register
-//address offset 0x04
-//reset value 0x00000000
-#define IWDG_PR (*(volatile uint16_t*)(0x40003000 + 0x04))
-//value
-#define WD_DIV4 0
-#define WD_DIV8 1
-#define WD_DIV16 2
-#define WD_DIV32 3
-#define WD_DIV64 4
-#define WD_DIV128 5
-#define WD_DIV256 6
-
-//reload register
-//address offset 0x08
-//reset value 0x00000FFF
-#define IWDG_RLR (*(volatile uint16_t*)(0x40003000 + 0x08))
-
-//status register
-//address offset 0x0C
-//reset value 0x00000000
-#define IWDG_SR (*(volatile uint16_t*)(0x40003000 + 0x0C))
-//macros
-#define RVU (IWDG_SR & 1)
-#define PVU (IWDG_SR & 2)
-
-void wd_set(uint16_t sec){
-    uint16_t time = sec * 145;
-    if(time > 0xfff) time = 0xfff;
-    SET_WD_ACCESS;
-    while(RVU){}
-    while(PVU){}
-    IWDG_PR = WD_DIV256;
-    IWDG_RLR = time;
-    SET_WD_RLOAD;
-    SET_WD_START;
+
+//RTC write protection keys
+#define RTC_KEY1 0xCA
+#define RTC_KEY2 0x53
+#define RTC_LOCK 0xFF
+
+#define RTC_UNLOCK() do { RTC->WPR = RTC_KEY1; RTC->WPR = RTC_KEY2; } while (0)
+
+#define STOP_EXTI_MASK (1 << STOP_EXTI_LINE)
+
+void stop_init(void)
+{
+    // The RTC lives in the backup domain, write protected after a reset.
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+    if (!(RCC->CSR & RCC_CSR_LSERDY)) {
+        RCC->CSR |= RCC_CSR_LSEON;
+        while (!(RCC->CSR & RCC_CSR_LSERDY)) {}
+    }
+    if (!(RCC->CSR & RCC_CSR_RTCEN))
+        RCC->CSR = (RCC->CSR & ~RCC_CSR_RTCSEL) | STM32_RTCSEL | RCC_CSR_RTCEN;
+
+    // Wakeup timer clocked by RTCCLK/16, interrupt on its EXTI line.
+    RTC_UNLOCK();
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUCKSEL);
+    while (!(RTC->ISR & RTC_ISR_WUTWF)) {}
+    RTC->WUTR = STOP_SLICE - 1;
+    RTC->CR |= RTC_CR_WUTIE;
+    RTC->WPR = RTC_LOCK;
+}
+
+void stop_wakeup_cb(EXTDriver *extp, expchannel_t channel)
+{
+    (void) extp;
+    (void) channel;
+    RTC->ISR &= ~RTC_ISR_WUTF;
+}
+
+/**
+ * @brief Restart the HSI and the PLL after a stop, which leaves the MCU on the
+ * MSI.
+ *
+ * @note  stm32_clock_init() expects a reset state, and overwrites the
+ * peripheral clock enables and the power control register.
+ */
+static void restore_clocks(void)
+{
+    uint32_t apb1 = RCC->APB1ENR;
+    uint32_t pwr  = PWR->CR & (PWR_CR_DBP | PWR_CR_ULP | PWR_CR_FWU);
+
+    stm32_clock_init();
+    RCC->APB1ENR |= apb1;
+    PWR->CR |= pwr;
 }
 
-/* CONSTROL/STATUS REGISTER */
-
-
-/* POWER CONTROL REGISTERS */
-//PWR base = 0x400073FF
-//PWR power control register
-//address offset: 0x00
-//reset value 0x00001000
-#define PWR_CR (*(volatile uint16_t*)(0x400073FF))
-//set standby mode
-//#define SET_PDDS (PWR_CR = (PWR_CR | 2))
-#define SET_PDDS (PWR_CR += 2)
-//set run deepsleep/sleep/low power mode
-//#define SET_LPSDSR (PWR_CR = (PWR_CR | 1))
-#define SET_LPSDSR (PWR_CR += 1)
-//set low power mode run
-//#define SET_LPRUN (PWR_CR = (PWR_CR | (1 << 14)))
-#define SET_LPRUN (PWR_CR += (1 << 14))
-//#define CLEAR_WUF (PWR_CR = (PWR_CR & 4))
-//CORTEX M3 SYSTEM CONTROL REGISTER
-#define ARM_SCR (*(volatile uint16_t*)(0xE000ED10))
-#define SET_SLEEPDEEP (ARM_SCR = (ARM_SCR | 4))
-
-//PWR power controll/status register
-//add offset 0x04
-//reset value 0x00000008
-#define PWR_CSR (*(volatile uint16_t*)(0x400073FF + 0x04))
-#define CLEAR_WUF (PWR_CSR = (PWR_CSR & ~1))
-#define CLEAR_EWUP (PWR_CSR = (PWR_CSR & ~(7 << 8)))
+/**
+ * @brief Clear the flags of a wakeup timer event, so it neither ends the next
+ * stop nor reaches its interrupt.
+ */
+static void clear_wakeup(void)
+{
+    RTC->ISR &= ~RTC_ISR_WUTF;
+    EXTI->PR = STOP_EXTI_MASK;
+    NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+}
+
+uint32_t stop_enter(uint32_t slices)
+{
+    uint32_t slept = 0;
+
+    // The timer restarts a full period when enabled.
+    RTC_UNLOCK();
+    RTC->CR |= RTC_CR_WUTE;
+    RTC->WPR = RTC_LOCK;
+
+    // Stop rather than standby, with the regulator in low power and the
+    // internal reference off.
+    PWR->CR = (PWR->CR & ~PWR_CR_PDDS) |
+              PWR_CR_LPSDSR | PWR_CR_ULP | PWR_CR_FWU | PWR_CR_CWUF;
+    SCB->SCR |= SCB_SCR_SLEEPDEEP;
+
+    while (slept < slices * STOP_SLICE) {
+        __WFI();
+        if (!(RTC->ISR & RTC_ISR_WUTF)) {
+            // Woken by another line, somewhere in the period.
+            slept += STOP_SLICE / 2;
+            break;
+        }
+        clear_wakeup();
+        slept += STOP_SLICE;
+    }
+
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP;
+    PWR->CR &= ~PWR_CR_LPSDSR;
+
+    restore_clocks();
+
+    RTC_UNLOCK();
+    RTC->CR &= ~RTC_CR_WUTE;
+    RTC->WPR = RTC_LOCK;
+    clear_wakeup();
+
+    return slept;
+}
 
 void deep_sleep(uint16_t sec){
-    wd_set(sec);
-    SET_SLEEPDEEP;
-    SET_PDDS;
-    CLEAR_WUF;
-    CLEAR_EWUP;
-    SET_LPSDSR;
-    SET_LPRUN;
-    asm("WFI;");
+    __disable_irq();
+    stop_enter((uint32_t) sec * STOP_HZ / STOP_SLICE);
+    __enable_irq();
 }
@@ -19,16 +19,69 @@
 
 /**
  * @file  standby_mode.h
- * @brief A function making the STM32 sleep.
+ * @brief Functions making the STM32 sleep in stop mode.
+ *
+ * The stop mode keeps the RAM and the registers, and is left on any EXTI
+ * line: the DIO of the SX1231 and the RTC wakeup timer, which counts the time
+ * spent asleep as the SysTick is halted.
  */
 
 #ifndef __STANBY_MODE_H__
 #define __STANBY_MODE_H__
 
 #include "stdint.h"
+#include "hal.h"
+
+/**
+ * @brief Frequency of the RTC wakeup timer, RTCCLK/16 with the 32768Hz LSE.
+ */
+#define STOP_HZ 2048
 
 /**
- * @brief Put the STM32L in sleep for certain times.
+ * @brief Period of the RTC wakeup timer, in STOP_HZ units.
+ *
+ * The MCU wakes up briefly at each period to count it. As the wakeup timer
+ * can not be read, a stop ended by another interrupt is only known to the
+ * period, and is accounted as half of it.
+ */
+#ifndef STOP_SLICE
+#define STOP_SLICE 32
+#endif
+
+/**
+ * @brief EXTI line of the RTC wakeup timer.
+ */
+#define STOP_EXTI_LINE 20
+
+/**
+ * @brief Start the RTC on the LSE and prepare its wakeup timer.
+ */
+void stop_init(void);
+
+/**
+ * @brief Callback of the EXTI line of the RTC wakeup timer.
+ *
+ * @note  To be put in the EXTConfig at STOP_EXTI_LINE.
+ */
+void stop_wakeup_cb(EXTDriver *extp, expchannel_t channel);
+
+/**
+ * @brief Put the STM32L in stop mode.
+ *
+ * @note  Must be called with the interrupts disabled by PRIMASK, an interrupt
+ * then ends the stop without being served. The clocks are restored before
+ * returning.
+ *
+ * @param slices The longest time to stay in stop, in STOP_SLICE periods.
+ *
+ * @return The time spent in stop, in STOP_HZ units.
+ */
+uint32_t stop_enter(uint32_t slices);
+
+/**
+ * @brief Put the STM32L in stop mode for certain times.
+ *
+ * @note  The RAM is kept, but the system time does not advance while asleep.
  *
  * @param sec    Time during which the STM32 will be asleep.
  */
@@ -22,6 +22,8 @@
  * @brief Low level functions for controlling the sx1231.
  * */
 
+#include <string.h>
+
 #include "sx1231.h"
 #include "dio.h"
 #include "global.h"
@@ -37,11 +39,88 @@ static const SPIConfig spi_cfg_sx = {
     0x10
 };
 
+/**
+ * @brief Number of registers shadowed: all but the test registers.
+ */
+#define SHADOW_SIZE REG_TEST_1
+
+/**
+ * @brief Copy of the registers, as last written or read.
+ */
+static uint8_t shadow [SHADOW_SIZE];
+
+/**
+ * @brief One bit per register, set when its copy is up to date.
+ */
+static uint8_t shadow_valid [SHADOW_SIZE / 8];
+
+/**
+ * @brief Tell whether a register may change on its own, or has to be written
+ * even with the same value. Those are never shadowed.
+ *
+ * @param address The address of the register.
+ *
+ * @return 1 if it does, 0 if not.
+ */
+static int is_volatile(uint8_t address)
+{
+    switch (address) {
+        case REG_FIFO:
+        case REG_OSC_1:           // RcCalStart/RcCalDone
+        case REG_LOW_BAT:         // LowBatMonitor
+        case REG_AFC_FEI:
+        case REG_AFC_MSB:
+        case REG_AFC_LSB:
+        case REG_FEI_MSB:
+        case REG_FEI_LSB:
+        case REG_RSSI_CONFIG:     // RssiStart/RssiDone
+        case REG_RSSI_VALUE:
+        case REG_IRQ_FLAGS_1:
+        case REG_IRQ_FLAGS_2:
+        case REG_PACKET_CONFIG_2: // RestartRx
+        case REG_TEMP_1:
+        case REG_TEMP_2:
+            return 1;
+        default:
+            return address >= SHADOW_SIZE;
+    }
+}
+
+/**
+ * @param address The address of a register.
+ *
+ * @return 1 if its shadow copy can be used instead of the register.
+ */
+static inline int is_shadowed(uint8_t address)
+{
+    return !is_volatile(address)
+        && (shadow_valid[address / 8] & (1 << (address % 8)));
+}
+
+/**
+ * @brief Keep a copy of registers just written or read.
+ *
+ * @param address The address of the first register.
+ * @param data    Their values.
+ * @param size    The number of registers.
+ */
+static void shadow_update(uint8_t address, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++, address++)
+        if (!is_volatile(address)) {
+            shadow[address] = data[i];
+            shadow_valid[address / 8] |= 1 << (address % 8);
+        }
+}
+
 /**
  * @brief Reset the SX1231 and initialised the SPI for the SX1231,
  */
 void sx_init(void)
 {
+    // The registers get back to their default values.
+    memset(shadow_valid, 0, sizeof shadow_valid);
+
     // SX1231 reset
     palSetPad(GPIOA, GPIOA_RF_RST);
     chThdSleepMilliseconds(100);
@@ -105,10 +184,23 @@ static inline void spi_send8(uint8_t b)
  */
 void sx_read(uint8_t address, void *data, size_t size)
 {
+    address &= 0x7F;
+
+    size_t i = 0;
+    while (i < size && is_shadowed(address + i))
+        i++;
+    if (i == size) {
+        memcpy(data, shadow + address, size);
+        return;
+    }
+
     SPITRANSACTION {
-        spi_send8(address & 0x7F);
+        spi_send8(address);
         spi_receive(data, size);
     }
+    // A burst from REG_FIFO reads the FIFO again and again.
+    if (address != REG_FIFO)
+        shadow_update(address, data, size);
 }
 
 /**
@@ -139,10 +231,72 @@ void sx_read_dummy(uint8_t address, size_t size)
  */
 void sx_write(uint8_t address, const void *data, size_t size)
 {
+    // The address and the data go out in a single transfer, up to a full
+    // FIFO.
+    uint8_t burst [FIFO_SIZE + 1];
+    if (size < sizeof burst) {
+        burst[0] = address | (1<<7);
+        memcpy(burst + 1, data, size);
+        SPITRANSACTION
+            spi_send(burst, size + 1);
+        if (address != REG_FIFO)
+            shadow_update(address, data, size);
+        return;
+    }
+
     SPITRANSACTION {
         spi_send8(address | (1<<7));
         spi_send(data, size);
     }
+    if (address != REG_FIFO)
+        shadow_update(address, data, size);
+}
+
+/**
+ * @brief Write in burst in the registers of the SX1231 whose value changes.
+ *
+ * Only the range from the first to the last register that changes is
+ * written, in a single burst. Nothing is written if none changes.
+ *
+ * @param address   First address in which we will write.
+ * @param data      Pointer of the buffer containing the data to write.
+ * @param size      Number of register to write
+ */
+void sx_update(uint8_t address, const void *data, size_t size)
+{
+    const uint8_t *d = data;
+    size_t first = size;
+    size_t last  = 0;
+
+    for (size_t i = 0; i < size; i++)
+        if (!is_shadowed(address + i) || shadow[address + i] != d[i]) {
+            if (first == size)
+                first = i;
+            last = i;
+        }
+
+    if (first < size)
+        sx_write(address + first, d + first, last - first + 1);
+}
+
+/**
+ * @brief Write registers from a table, in as few bursts as possible.
+ *
+ * @param table The registers and their values, by increasing address.
+ * @param size  The number of registers.
+ */
+void sx_configure(const struct SxRegister *table, size_t size)
+{
+    uint8_t burst [SHADOW_SIZE];
+
+    for (size_t i = 0; i < size; ) {
+        // Gather the registers following each other.
+        size_t n = 0;
+        do {
+            burst[n++] = table[i++].value;
+        } while (i < size && table[i].address == table[i - 1].address + 1);
+        sx_update(table[i - n].address, burst, n);
+    }
 }
 
 /**
@@ -153,7 +307,7 @@ void sx_write(uint8_t address, const void *data, size_t size)
  */
 void sx_write8(uint8_t address, uint8_t data)
 {
-    sx_write(address, &data, 1);
+    sx_update(address, &data, 1);
 }
 
 /**
@@ -165,7 +319,7 @@ void sx_write8(uint8_t address, uint8_t data)
 void sx_write16(uint8_t address, uint16_t data)
 {
     uint16_t data_be = ((data & 0xff) << 8) | ((data & 0xff00) >> 8);
-    sx_write(address, &data_be, 2);
+    sx_update(address, &data_be, 2);
 }
 
 /**
@@ -178,7 +332,7 @@ void sx_write24(uint8_t address, uint32_t data)
 {
     uint32_t data_be = (((data & 0xff) << 16) | ((data & 0xff00)) |
                        ((data & 0xff0000) >> 16));
-    sx_write(address, &data_be, 3);
+    sx_update(address, &data_be, 3);
 }
 
 /**
@@ -203,11 +357,11 @@ uint8_t sx_read8(uint8_t address)
  */
 void sx_mode(uint8_t mode)
 {
-    sx_write8(REG_OP_MODE, ((sx_read8(REG_OP_MODE) & !(MODE(0b11))) |
+    sx_write8(REG_OP_MODE, ((sx_read8(REG_OP_MODE) & ~MODE(0b111)) |
                             MODE(mode)));
     wait_mode_ready();
     if (mode == RX)
-        chThdSleepMilliseconds(100); // wait_rx_ready();
+        wait_rx_ready();
 }
 
 
@@ -220,7 +374,9 @@ void sx_mode(uint8_t mode)
 uint8_t scan_rssi(void)
 {
     sx_write8(REG_RSSI_CONFIG, RSSI_START(ON));
-    while(!(sx_read8(REG_RSSI_CONFIG) & RSSI_DONE)) ;
+    // No DIO tells when the measure is done, let the other threads run.
+    while(!(sx_read8(REG_RSSI_CONFIG) & RSSI_DONE))
+        chThdYield();
     return sx_read8(REG_RSSI_VALUE);
 }
 
@@ -255,6 +411,8 @@ void empty_fifo(void)
 }
 
 /************************ Communication functions ****************************/
+static uint8_t last_rssi = 0xFF; /**< RSSI of the last packet received. */
+
 /**
  * @param a   First size to evaluate.
  * @param b   Second size to evaluate.
@@ -266,6 +424,23 @@ static inline size_t min(size_t a, size_t b)
     return a < b ? a : b;
 }
 
+/**
+ * @brief The packet sent by send_packet, for copy_packet.
+ */
+static const uint8_t *tx_packet;
+
+/**
+ * @brief Fill a chunk with the packet sent by send_packet.
+ *
+ * @param chunk  Where to copy the bytes.
+ * @param offset The offset of the chunk in the packet.
+ * @param size   The size of the chunk.
+ */
+static void copy_packet(void *chunk, size_t offset, size_t size)
+{
+    memcpy(chunk, tx_packet + offset, size);
+}
+
 /**
  * @brief Send a packet through radio.
  *
@@ -276,6 +451,22 @@ static inline size_t min(size_t a, size_t b)
  * @return SX1231_ERR
  */
 int send_packet(const void *packet, size_t size, systime_t timeout)
+{
+    tx_packet = packet;
+    return send_packet_stream(size, copy_packet, timeout);
+}
+
+/**
+ * @brief Send a packet through radio, fetching it chunk by chunk as the radio
+ * FIFO empties, so that it needs not be in RAM as a whole.
+ *
+ * @param size      Size of the packet. Cannot be up to 255.
+ * @param fill      The function fetching the chunks.
+ * @param timeout   Time during which we try to send a message.
+ *
+ * @return SX1231_ERR
+ */
+int send_packet_stream(size_t size, tx_fill_t fill, systime_t timeout)
 {
     // Wait for RSSI level
     sx_mode(RX);
@@ -287,27 +478,74 @@ int send_packet(const void *packet, size_t size, systime_t timeout)
         return CHANNEL_BUSY;
     }
 
+    return sx_transmit(size, fill);
+}
+
+/**
+ * @brief Listen to the channel for a while, to know whether someone else is
+ * emitting. The SX1231 is left in RX mode.
+ *
+ * @param listen    Time during which we listen.
+ *
+ * @return 1 if the channel is clear, 0 if it is busy.
+ */
+int sx_channel_clear(systime_t listen)
+{
+    sx_mode(RX);
+
+    // A packet is being received: restarting the receiver would lose it.
+    if (sx_read8(REG_IRQ_FLAGS_1) & FLAG_1_SYNC_ADDRESS)
+        return 0;
+
+    // The RSSI flag stays set once the threshold has been crossed: restart
+    // the receiver, so that it only tells about the time we listen.
+    sx_write8(REG_PACKET_CONFIG_2,
+              sx_read8(REG_PACKET_CONFIG_2) | RESTART_RX(ON));
+    rssi_on_dio4();
+    int busy = wait_dio4_timeout(listen, TRUE);
+    rx_ready_on_dio4();
+    return !busy;
+}
+
+/**
+ * @brief Send a packet through radio right away, without checking the
+ * channel, fetching it chunk by chunk as the radio FIFO empties.
+ *
+ * @param size      Size of the packet. Cannot be up to 255.
+ * @param fill      The function fetching the chunks.
+ *
+ * @return SX1231_ERR
+ */
+int sx_transmit(size_t size, tx_fill_t fill)
+{
+    // The chunks are filled after the FIFO address, to be sent in a single
+    // transfer.
+    uint8_t chunk [FIFO_SIZE];
+    chunk[0] = REG_FIFO | (1<<7);
+    size_t  offset = 0;
+
     sx_mode(STDBY);
 
     packet_sent_on_dio0();
     sx_write8(REG_FIFO, size);
     {
         size_t sent = min(size, FIFO_SIZE - 1);
-        sx_write(REG_FIFO, packet, sent);
-        packet += sent;
-        size -= sent;
+        fill(chunk + 1, offset, sent);
+        SPITRANSACTION
+            spi_send(chunk, sent + 1);
+        offset += sent;
     }
     sx_mode(TX);
-    while (size) {
+    while (offset < size) {
         wait_not_fifo_level();
-        size_t sent = min(size, FIFO_SIZE - VALUE_FIFO_THRESH - 1);
-        sx_write(REG_FIFO, packet, sent);
-        packet += sent;
-        size -= sent;
+        size_t sent = min(size - offset, FIFO_SIZE - VALUE_FIFO_THRESH - 1);
+        fill(chunk + 1, offset, sent);
+        SPITRANSACTION
+            spi_send(chunk, sent + 1);
+        offset += sent;
     }
     wait_packet_sent();
     assert(!check_fifo_not_empty());
-    chThdSleepMilliseconds(10);
     sx_mode(STDBY);
     return TX_SUCCESS;
 }
@@ -323,6 +561,25 @@ int send_packet(const void *packet, size_t size, systime_t timeout)
  */
 int receive_packet(void *packet, size_t max_size, systime_t timeout)
 {
+    return receive_packet_filtered(packet, max_size, timeout, NULL);
+}
+
+/**
+ * @brief Same as receive_packet, but hand the first chunk of a long packet to
+ * a filter, and stop receiving it if the filter is not interested.
+ *
+ * @param  packet   Buffer where the packet received will be stocked.
+ * @param  max_size Maximum size allowed for receiving a packet.
+ * @param  timeout  Time during which we wait for a packet.
+ * @param  filter   The filter, or NULL to receive everything.
+ *
+ * @return The size of the packet, if the packet is correct or SX1231_ERR
+ */
+int receive_packet_filtered(void *packet, size_t max_size, systime_t timeout,
+                            rx_filter_t filter)
+{
+    const void *head = packet;
+
     payload_ready_on_dio0(); // In order to check payload ready
 
     sx_write8(REG_PAYLOAD_LENGTH, max_size);
@@ -332,14 +589,19 @@ int receive_packet(void *packet, size_t max_size, systime_t timeout)
     if (!wait_message(timeout))
         return TIMEOUT;
 
+    // The RSSI is still that of the packet until we leave RX mode.
+    last_rssi = sx_read8(REG_RSSI_VALUE);
+
     size_t size          = sx_read8(REG_FIFO);
     ssize_t bytes_left   = size;
 
     while (bytes_left > 0) {
         while (wait_message(TIME_INFINITE) == 0) ;
         if (check_payload_ready()) {
-            // CRC_OK flag is reset when going out of RX mode
-            if (!(sx_read8(REG_IRQ_FLAGS_2) & FLAG_2_CRC_OK)) {
+            // CRC_OK flag is reset when going out of RX mode, and is not
+            // set when the CRC is left to the software
+            if ((sx_read8(REG_PACKET_CONFIG_1) & CRC_ON(ON))
+                    && !(sx_read8(REG_IRQ_FLAGS_2) & FLAG_2_CRC_OK)) {
                 sx_mode(STDBY);
                 empty_fifo();
                 return RECEIVE_CRC_ERROR;
@@ -354,7 +616,21 @@ int receive_packet(void *packet, size_t max_size, systime_t timeout)
             sx_read(REG_FIFO, packet, VALUE_FIFO_THRESH);
             bytes_left -= VALUE_FIFO_THRESH;
             packet     += VALUE_FIFO_THRESH;
+
+            // The rest of a packet we do not want is not worth the SPI
+            // transfers: leave RX mode, which aborts the reception.
+            if (filter && packet == head + VALUE_FIFO_THRESH
+                    && !filter(head, VALUE_FIFO_THRESH)) {
+                sx_mode(STDBY);
+                empty_fifo();
+                return RECEIVE_DROPPED;
+            }
         }
     }
     return 0;  // Empty packet, should not happen
 }
+
+uint8_t sx_rssi(void)
+{
+    return last_rssi;
+}
@@ -669,7 +669,38 @@ void sx_write(uint8_t address, const void *data, size_t size);
 uint8_t sx_read8(uint8_t address);
 
 /**
- * @brief Write a byte in a register of the SX1231.
+ * @brief Write in burst in the registers of the SX1231 whose value changes.
+ *
+ * The registers written or read are shadowed in RAM, but for those changing
+ * on their own (FIFO, flags, measures). Only the range from the first to the
+ * last register that changes is written, in a single burst. Nothing is
+ * written if none changes.
+ *
+ * @param address  First address in which we will write.
+ * @param data     Pointer of the buffer containing the data to write.
+ * @param size     Number of register to write
+ */
+void sx_update(uint8_t address, const void *data, size_t size);
+
+/**
+ * @brief A register and its value, for sx_configure.
+ */
+struct SxRegister {
+    uint8_t address;
+    uint8_t value;
+};
+
+/**
+ * @brief Write registers from a table, in as few bursts as possible: the
+ * registers following each other are written together.
+ *
+ * @param table The registers and their values, by increasing address.
+ * @param size  The number of registers.
+ */
+void sx_configure(const struct SxRegister *table, size_t size);
+
+/**
+ * @brief Write a byte in a register of the SX1231, if its value changes.
  *
  * @param address  The address of the register to write in.
  * @param data     The byte to write.
@@ -677,7 +708,8 @@ uint8_t sx_read8(uint8_t address);
 void sx_write8(uint8_t address, uint8_t data);
 
 /**
- * @brief Write two bytes in two consecutive registers of the SX1231.
+ * @brief Write two bytes in two consecutive registers of the SX1231, if their
+ * value changes.
  *
  * @param address  The address of the first register where we will write.
  * @param data     The bytes to write.
@@ -685,7 +717,8 @@ void sx_write8(uint8_t address, uint8_t data);
 void sx_write16(uint8_t address, uint16_t data);
 
 /**
- * @brief Write three bytes in three conecutive registers of the SX1231.
+ * @brief Write three bytes in three conecutive registers of the SX1231, if
+ * their value changes.
  *
  * @param address  The address of the register to read.
  * @param data     The bytes to write.
@@ -742,8 +775,20 @@ void empty_fifo(void);
 #define RECEIVE_TOO_LONG  -3 /**< The packet received is larger than
                               * expected */
 #define CHANNEL_BUSY      -4 /**< Someone else is emmitting on the channel */
+#define RECEIVE_DROPPED   -5 /**< The packet has been dropped by the filter
+                              * before being fully received */
 /** @} */
 
+/**
+ * @brief Decide from its first bytes whether a packet is worth receiving.
+ *
+ * @param head The first bytes of the packet, without the length byte.
+ * @param size Their number, at least VALUE_FIFO_THRESH.
+ *
+ * @return 1 to receive the rest of the packet, 0 to drop it.
+ */
+typedef int (*rx_filter_t)(const void *head, size_t size);
+
 /**
  * @brief Send a packet through radio.
  *
@@ -755,6 +800,48 @@ void empty_fifo(void);
  */
 int send_packet(const void *packet, size_t size, systime_t timeout);
 
+/**
+ * @brief Fill a chunk of a packet being sent.
+ *
+ * @param chunk  Where to copy the bytes.
+ * @param offset The offset of the chunk in the packet.
+ * @param size   The size of the chunk.
+ */
+typedef void (*tx_fill_t)(void *chunk, size_t offset, size_t size);
+
+/**
+ * @brief Send a packet through radio, fetching it chunk by chunk as the radio
+ * FIFO empties, so that it needs not be in RAM as a whole.
+ *
+ * @param size      Size of the packet. Cannot be up to 255.
+ * @param fill      The function fetching the chunks.
+ * @param timeout   Time during which we try to send a message.
+ *
+ * @return SX1231_ERR
+ */
+int send_packet_stream(size_t size, tx_fill_t fill, systime_t timeout);
+
+/**
+ * @brief Listen to the channel for a while, to know whether someone else is
+ * emitting. The SX1231 is left in RX mode.
+ *
+ * @param listen    Time during which we listen.
+ *
+ * @return 1 if the channel is clear, 0 if it is busy.
+ */
+int sx_channel_clear(systime_t listen);
+
+/**
+ * @brief Send a packet through radio right away, without checking the
+ * channel, fetching it chunk by chunk as the radio FIFO empties.
+ *
+ * @param size      Size of the packet. Cannot be up to 255.
+ * @param fill      The function fetching the chunks.
+ *
+ * @return SX1231_ERR
+ */
+int sx_transmit(size_t size, tx_fill_t fill);
+
 /**
  * @brief Pass the SX1231 in RX mode and try to catch a radio packet.
  *
@@ -766,4 +853,28 @@ int send_packet(const void *packet, size_t size, systime_t timeout);
  */
 int receive_packet(void *packet, size_t max_size, systime_t timeout);
 
+/**
+ * @brief Same as receive_packet, but hand the first chunk of a long packet to
+ * a filter, and stop receiving it if the filter is not interested.
+ *
+ * Packets shorter than VALUE_FIFO_THRESH are received in one go and not
+ * filtered.
+ *
+ * @param  packet   Buffer where the packet received will be stocked.
+ * @param  max_size Maximum size allowed for receiving a packet.
+ * @param  timeout  Time during which we wait for a packet.
+ * @param  filter   The filter, or NULL to receive everything.
+ *
+ * @return The size of the packet, if the packet is correct or SX1231_ERR
+ */
+int receive_packet_filtered(void *packet, size_t max_size, systime_t timeout,
+                            rx_filter_t filter);
+
+/**
+ * @brief Get the RSSI measured during the reception of the last packet.
+ *
+ * @return The RSSI, in -0.5 dBm.
+ */
+uint8_t sx_rssi(void);
+
 #endif //__SX1231_H__
@@ -0,0 +1,125 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  airtime.h
+ * @brief Keep our airtime within the duty cycle allowed in the 433 MHz band.
+ *
+ * The time spent sending on each channel is accounted over a sliding window
+ * of AIRTIME_WINDOW, made of AIRTIME_SLOTS slots. The duty cycle applies to
+ * the device across the band: the packets are only sent while the time spent
+ * on all the channels together leaves some of the AIRTIME_DUTY budget, and
+ * the less valuable packets stop earlier, so that the budget left goes to the
+ * messages: ROOTs stop at AIRTIME_ROOT_SHARE of the budget, the other
+ * synchronisation packets at AIRTIME_SYNC_SHARE. The time spent on each
+ * channel is only kept for reporting.
+ */
+
+#ifndef __AIRTIME_H__
+#define __AIRTIME_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ch.h"
+
+/**
+ * @brief Length of the sliding window.
+ */
+#ifndef AIRTIME_WINDOW
+#define AIRTIME_WINDOW S2ST(3600)
+#endif
+
+/**
+ * @brief Number of slots of the window.
+ */
+#define AIRTIME_SLOTS 6
+
+/**
+ * @brief Number of centre frequencies, see dash7.c.
+ */
+#define AIRTIME_FREQUENCIES 15
+
+/**
+ * @brief Share of the window during which we may send, all the channels
+ * together, in 1/1000.
+ */
+#ifndef AIRTIME_DUTY
+#define AIRTIME_DUTY 100
+#endif
+
+/**
+ * @brief Share of the budget, in %, above which ROOTs, and then the other
+ * synchronisation packets, are not sent anymore.
+ */
+#define AIRTIME_ROOT_SHARE 50
+#define AIRTIME_SYNC_SHARE 75
+
+/**
+ * @brief Bytes sent along with each packet: preamble, sync word, length and
+ * CRC.
+ */
+#define AIRTIME_OVERHEAD 9
+
+/**
+ * @brief Account for a packet sent. Called by the radio thread.
+ *
+ * @param channel The channel it has been sent on.
+ * @param size    Its size.
+ */
+void airtime_spent(uint8_t channel, size_t size);
+
+/**
+ * @brief Tell whether a packet may be sent.
+ *
+ * @param type Its type.
+ *
+ * @return 1 if it may, 0 if the budget left is kept for more valuable
+ * packets.
+ */
+int airtime_allows(uint8_t type);
+
+/**
+ * @brief Tell whether some more time may be spent sending, whatever it is
+ * for. Called by the radio thread before waking the neighbours up.
+ *
+ * @param us The time, in us.
+ *
+ * @return 1 if the budget is not exceeded, 0 if it is.
+ */
+int airtime_affords(uint32_t us);
+
+/**
+ * @brief Get the time spent sending on all the channels during the window.
+ *
+ * @return The time, in us.
+ */
+uint32_t airtime_total(void);
+
+/**
+ * @brief Get the time spent sending on a channel during the window, for the
+ * host to see. See get_airtime.
+ *
+ * @param channel The channel, or its centre frequency.
+ *
+ * @return The time, in us.
+ */
+uint32_t airtime_used(uint8_t channel);
+
+#endif // __AIRTIME_H__
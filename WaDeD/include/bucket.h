@@ -25,6 +25,16 @@
 #ifndef __BUCKET_H__
 #define __BUCKET_H__
 
+/**
+ * @brief Hop limit of the messages flooded in the whole network.
+ */
+#define HOP_UNLIMITED 0xFF
+
+/**
+ * @brief State bit of the messages which are not part of the trees.
+ */
+#define BUCKET_LOCAL 0x10
+
 /**
  * @brief A memory bucket for storage of a message and its metadata.
  */
@@ -42,15 +52,20 @@ struct Bucket {
     uint16_t destination_address;
     uint16_t next_timestamp;
     uint16_t next_id; // ID of the next packet
-    uint8_t  hop_limit;
+    uint16_t next_emission; // Next packet, by decreasing emission date
+    uint8_t  hop_limit; // Relays left, or HOP_UNLIMITED
     uint8_t  type_id;
 
     // The state field holds several 1-bit informations:
     // bit 0 is set when the bucket is used.
     // bit 1 is set when the bucket is the first bucket of timestamps.
     // bit 2 is set when the bucket is the first bucket of its ID list.
+    // bit 3 is set when the bucket is the first bucket of emissions.
+    // bit 4 is set when the message has a limited number of hops: it is kept
+    // locally, but is not part of the trees.
 
     uint8_t  state;
+    uint8_t  length; // Length of the message, without its terminator
 
     uint8_t  message [141];
 };
@@ -0,0 +1,175 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  channel.h
+ * @brief Choice of the radio channel.
+ *
+ * The WaDeDs meet on a rendezvous channel, where the ROOTs, NODEs, LEAFs and
+ * broadcast MESSAGEs are exchanged. The sessions, which carry many messages
+ * between two of them, are moved to a data channel negotiated with the OFFER
+ * or the SINCE, so that several sessions of a neighbourhood run in parallel
+ * instead of fighting over one frequency.
+ *
+ * Only the DATAs and ACKs of the sessions go on the data channel, and we only
+ * listen to it for CHANNEL_QUIET after the last of them: the rest of the time,
+ * we are on the rendezvous channel with the others. A session packet sent
+ * after such a pause goes on the rendezvous channel, where the peer is, and
+ * brings both sides back to the data channel.
+ *
+ * The class of the channel, its upper four bits, gives the rate: the data
+ * channels are used in the hi-rate class for the links which lose packets,
+ * and in the blink class, four times faster, for the others. Built with
+ * __FEC__, the weak links use coded channels, flagged by CHANNEL_FEC.
+ *
+ * Built with __HOPPING__, a session hops from data channel to data channel
+ * every CHANNEL_DWELL, starting from the channel negotiated.
+ */
+
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+#include "dash7.h"
+
+/**
+ * @brief The channel where the WaDeDs meet.
+ */
+#define CHANNEL_RENDEZVOUS HI_RATE_CHANNEL
+
+/**
+ * @brief Classes of the data channels.
+ */
+#define CHANNEL_SLOW 0x20
+#define CHANNEL_FAST 0x30
+
+/**
+ * @brief Flag of the coded channels, see fec.h.
+ */
+#define CHANNEL_FEC 0x80
+
+/**
+ * @brief Number of data channels of each class.
+ */
+#define CHANNEL_SLOW_COUNT 6
+#define CHANNEL_FAST_COUNT 2
+#define CHANNEL_DATA_COUNT (CHANNEL_SLOW_COUNT + CHANNEL_FAST_COUNT)
+
+/**
+ * @brief Time spent on a data channel before hopping to the next one.
+ */
+#ifndef CHANNEL_DWELL
+#define CHANNEL_DWELL MS2ST(400)
+#endif
+
+/**
+ * @brief Time after the last DATA or ACK of the sessions during which we
+ * listen to the data channel rather than to the rendezvous channel.
+ */
+#ifndef CHANNEL_QUIET
+#define CHANNEL_QUIET MS2ST(1000)
+#endif
+
+/**
+ * @brief Time without DATA after which the receiver of a session leaves the
+ * data channel.
+ */
+#ifndef CHANNEL_LINGER
+#define CHANNEL_LINGER S2ST(3)
+#endif
+
+/**
+ * @brief Choose the channel to propose to a neighbour for a session: the one
+ * we are already on, or else the data channel we found the least busy.
+ *
+ * @param fast Whether the link with the neighbour allows the fast rate.
+ * @param fec  Whether it needs to be coded.
+ *
+ * @return The channel.
+ */
+uint8_t channel_propose(int fast, int fec);
+
+/**
+ * @brief Make a data channel proposed to us at least as robust as our view of
+ * the link requires.
+ *
+ * @param channel The channel.
+ * @param fast    Whether the link allows the fast rate.
+ * @param fec     Whether it needs to be coded.
+ *
+ * @return The same channel, at the slow rate if not fast, coded if fec, or
+ * channel itself if it is not a data channel.
+ */
+uint8_t channel_robust(uint8_t channel, int fast, int fec);
+
+/**
+ * @brief Move to a data channel for a session.
+ *
+ * Several sessions may share the data channel we are on, but not use
+ * another one. Under __HOPPING__, a session cannot join the hops of another.
+ *
+ * @param channel The channel negotiated.
+ * @param later   Move only once the packet being prepared is sent.
+ *
+ * @return 1 if we moved, and channel_leave has to be called at the end of the
+ * session, 0 if we stay where we are.
+ */
+int channel_join(uint8_t channel, int later);
+
+/**
+ * @brief Leave the data channel joined by a session. The last session to
+ * leave takes us back to the rendezvous channel.
+ */
+void channel_leave(void);
+
+/**
+ * @brief Tell that a packet has been sent, for the moves waiting for it.
+ *
+ * @param session Whether it was a DATA or an ACK, which keeps us on the data
+ * channel.
+ */
+void channel_sent(int session);
+
+/**
+ * @brief Tell that a DATA or an ACK of our sessions has been received, which
+ * keeps us on the data channel.
+ */
+void channel_active(void);
+
+/**
+ * @brief Get the channel to listen and send the session packets on. The
+ * other packets are sent on CHANNEL_RENDEZVOUS. Called by the radio thread.
+ *
+ * @param left Set to the time during which it remains valid.
+ *
+ * @return The channel.
+ */
+uint8_t channel_now(systime_t *left);
+
+/**
+ * @brief Note that a channel has been found busy, that a packet received on
+ * it has been corrupted, or that neighbours have taken it for a session.
+ *
+ * @param channel The channel.
+ */
+void channel_busy(uint8_t channel);
+
+#endif // __CHANNEL_H__
@@ -28,6 +28,7 @@
 #include "stdint.h"
 #include "bucket.h"
 #include "timestamp.h"
+#include "power.h"
 
 #define UNDEF_ID 0
 #define SEND_TXT_CMD "send_txt"
@@ -48,6 +49,24 @@
 #define MY_ID_ID 8
 #define SET_DATE_CMD "set_date"
 #define SET_DATE_ID 9
+#define SET_HOP_CMD "set_hop"
+#define SET_HOP_ID 10
+#define SET_ROLE_CMD "set_role"
+#define SET_ROLE_ID 11
+#define SET_QUOTA_CMD "set_quota"
+#define SET_QUOTA_ID 12
+#define GET_POWER_CMD "get_power"
+#define GET_POWER_ID 13
+#define POWER_CMD "power"
+#define POWER_ID 14
+#define GET_ROLE_CMD "get_role"
+#define GET_ROLE_ID 15
+#define ROLE_CMD "role"
+#define ROLE_ID 16
+#define GET_AIRTIME_CMD "get_airtime"
+#define GET_AIRTIME_ID 17
+#define AIRTIME_CMD "airtime"
+#define AIRTIME_ID 18
 
 #define CMD_BUF_SIZE 170
 extern char cmd_buf[];
@@ -59,6 +78,10 @@ extern uint16_t host_id;
  *
  * set_id puts the id in buc->source_address.
  * send_txt puts the id in destination_address and message in message.
+ * set_hop puts the hop limit in hop_limit.
+ * set_role puts the role in type_id.
+ * set_quota puts the source in source_address and the quota in
+ * destination_address.
  *
  * @param buc A bucket to store things.
  *
@@ -73,12 +96,34 @@ uint16_t get_command(struct Bucket *buc);
  */
 void send_usr_id(uint16_t id);
 
+/**
+ * @brief Send to the user the time spent in each power state.
+ *
+ * @param stats The times.
+ */
+void send_usr_power(const struct PowerStats *stats);
+
+/**
+ * @brief Send to the user our role.
+ *
+ * @param role ROLE_STONE or ROLE_ZOMBIE.
+ */
+void send_usr_role(uint8_t role);
+
+/**
+ * @brief Send to the user the time spent sending during the airtime window.
+ */
+void send_usr_airtime(void);
+
 /**
  * @brief Send to the user a message destined to him.
  *
  * @param buc The bucket containing the message.
+ *
+ * @return 1 if the message has been delivered, 0 if it is not for our host or
+ * no host is connected.
  */
-void send_usr_message(const struct Bucket * buc);
+int send_usr_message(const struct Bucket * buc);
 
 /**
  * @brief Try to grab 3 pings before starting comunication.
@@ -99,6 +144,20 @@ ping
     answered by an ack
 get_id
     ask for our id
+set_hop x
+    x is the number of relays allowed for the messages we send next, 255 to
+    flood them in the whole network
+set_role x
+    x is 0 for a stone, 1 for a zombie
+set_quota x n
+    x is the id of a source, n the number of its messages we keep before
+    evicting them first when the memory is full
+get_power
+    ask for the time spent in each power state
+get_role
+    ask for our role
+get_airtime
+    ask for the time spent sending during the airtime window
 
 Answers list:
 ack
@@ -110,5 +169,14 @@ rec_txt x string
     string is the message
 my_id x
     x is our id
+power r s t n f w
+    r, s and t are the seconds spent running, sleeping and in stop mode
+    since boot, n the number of times the stop mode has been entered, f the
+    seconds the FRAM spent in sleep mode and w the number of its wake-ups
+role x
+    x is 0 for a stone, 1 for a zombie
+airtime t f0 ... f14
+    t is the ms spent sending on all the channels together, counted against
+    the duty cycle, and fi the ms spent on the centre frequency i
 
 *************************************/
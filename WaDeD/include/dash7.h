@@ -55,6 +55,13 @@ void dash7_init(void);
  */
 void select_channel(uint8_t channel);
 
+/**
+ * @brief Select who checks and whitens the packets.
+ *
+ * @param software 0 for the SX1231, 1 for the software, see fec.h.
+ */
+void select_coding(int software);
+
 #define BACKGROUND_MODE 0xE6D0
 #define FOREGROUND_MODE 0x0B67
 
@@ -34,6 +34,12 @@
 #define DIO4_MASK  (1 << 4)
 #define DIO5_MASK  (1 << 5)
 
+/**
+ * @brief Event signalled to a thread waiting for a packet, to make it give up
+ * the wait.
+ */
+#define DIO_WAKE_MASK (1 << 6)
+
 /*
  * DIO Mapping
  * DIO0: 00: RX: CRC_ok      TX: Packet_sent / 01: RX: payload_ready
@@ -158,7 +164,7 @@ static inline void packet_sent_on_dio0(void)
  */
 static inline void rssi_on_dio4(void)
 {
-    sx_write8(REG_DIO_MAPPING_1,(DIO4_MAPPING(0b01) |
+    sx_write8(REG_DIO_MAPPING_2,(DIO4_MAPPING(0b01) |
                                  DIO5_MAPPING(0b11) |
                                  CLK_OUT(CLK_OUT_OFF)));
 }
@@ -171,7 +177,7 @@ static inline void rssi_on_dio4(void)
  */
 static inline void rx_ready_on_dio4(void)
 {
-    sx_write8(REG_DIO_MAPPING_1,(DIO4_MAPPING(0b10) |
+    sx_write8(REG_DIO_MAPPING_2,(DIO4_MAPPING(0b10) |
                                  DIO5_MAPPING(0b11) |
                                  CLK_OUT(CLK_OUT_OFF)));
 }
@@ -180,7 +186,8 @@ static inline void rx_ready_on_dio4(void)
  * @brief Wait for a certain for a message to be received.
  *
  * @note  This function read payload_ready, the mapping must be set for
- * reading payload_ready if it has been changed previously.
+ * reading payload_ready if it has been changed previously. The wait also ends
+ * on DIO_WAKE_MASK.
  *
  * @param timeout     The time during which the function will wait for a
  * message.
@@ -190,7 +197,7 @@ static inline bool_t wait_message(systime_t timeout)
     chEvtGetAndClearEvents(DIO0_MASK | DIO1_MASK);
     if (check_fifo_level() || check_payload_ready())
         return 1;
-    chEvtWaitAnyTimeout(DIO0_MASK | DIO1_MASK, timeout);
+    chEvtWaitAnyTimeout(DIO0_MASK | DIO1_MASK | DIO_WAKE_MASK, timeout);
     return check_fifo_level() || check_payload_ready();
 }
 #endif // __DIO_H__
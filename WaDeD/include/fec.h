@@ -0,0 +1,94 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  fec.h
+ * @brief Forward error correction and whitening of the radio packets.
+ *
+ * The SX1231 drops a packet as soon as a single bit is wrong. On a coded
+ * channel, its CRC and whitening are turned off, and they are done here
+ * instead, along with a Reed-Solomon code which corrects up to
+ * FEC_PARITY / 2 wrong bytes:
+ *
+ * - the packet,
+ * - its CRC-16 (CCITT), MSB first,
+ * - FEC_PARITY parity bytes, computed over the two above,
+ *
+ * all of it whitened with a PN9 sequence. The code is systematic, so that the
+ * first bytes of a packet can be looked at before it is decoded.
+ */
+
+#ifndef __FEC_H__
+#define __FEC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sx1231.h"
+
+/**
+ * @brief Number of parity bytes of the Reed-Solomon code.
+ */
+#define FEC_PARITY 16
+
+/**
+ * @brief Number of bytes added to a packet by the coding.
+ */
+#define FEC_OVERHEAD (2 + FEC_PARITY)
+
+/**
+ * @brief Start coding a packet. Its chunks are then to be fetched in order
+ * with fec_fill.
+ *
+ * @param size The size of the packet.
+ * @param fill The function fetching the chunks of the packet.
+ *
+ * @return The size of the coded packet.
+ */
+size_t fec_start(size_t size, tx_fill_t fill);
+
+/**
+ * @brief Fetch the next chunk of the packet being coded, see tx_fill_t.
+ *
+ * @param chunk  Where to put the coded bytes.
+ * @param offset The offset of the chunk in the coded packet.
+ * @param size   The size of the chunk.
+ */
+void fec_fill(void *chunk, size_t offset, size_t size);
+
+/**
+ * @brief Remove the whitening of the first bytes of a coded packet.
+ *
+ * @param buf  The bytes.
+ * @param size Their number.
+ */
+void fec_whiten(void *buf, size_t size);
+
+/**
+ * @brief Decode a coded packet, in place.
+ *
+ * @param buf  The coded packet.
+ * @param size Its size.
+ *
+ * @return The size of the packet, or RECEIVE_CRC_ERROR if it has too many
+ * errors.
+ */
+int fec_decode(void *buf, size_t size);
+
+#endif // __FEC_H__
@@ -32,8 +32,30 @@
 #include "hal.h"
 #endif
 
+#include "jungle.h"
+
 #define FIFO_MAXSIZE 20
 
+/**
+ * @brief Number of identical ROOTs that, once heard during a period, make us
+ * skip our own.
+ */
+#define ROOT_REDUNDANCY 2
+
+/**
+ * @brief Bounds of the period between two of our ROOTs, for a stone. See
+ * struct Role.
+ *
+ * The period starts at the minimum, doubles while our neighbours agree with
+ * us, and goes back to the minimum on any inconsistency.
+ */
+#ifndef ROOT_INTERVAL_MIN
+#define ROOT_INTERVAL_MIN S2ST(1)
+#endif
+#ifndef ROOT_INTERVAL_MAX
+#define ROOT_INTERVAL_MAX S2ST(64)
+#endif
+
 /**
  * @brief Places in fifo the information about a packet to send.
  *
@@ -42,9 +64,39 @@
  */
 #ifndef __SIMU__
 //USE_MEMORY
-extern uint8_t tx_buffer[164];
+extern uint8_t tx_buffer[PACKET_MAX_SIZE];
 #endif
 
+/**
+ * @brief Write the header of a packet in tx_buffer.
+ *
+ * @param type   The type of the packet.
+ * @param length The length of the packet, stripped of the header.
+ */
+void fifo_put_header(uint8_t type, uint8_t length);
+
+/**
+ * @brief Write a stored message in tx_buffer, as in a MESSAGE packet.
+ *
+ * Only the header of the message is written: its text is read from FRAM by
+ * fifo_tx_fill while the packet is sent.
+ *
+ * @param body    Where to write the message, in tx_buffer.
+ * @param address The address of the message in FRAM.
+ *
+ * @return The size of the message, text included.
+ */
+uint8_t fifo_put_message(uint8_t *body, uint16_t address);
+
+/**
+ * @brief Copy a part of the packet prepared by fifo_pop, to be sent.
+ *
+ * @param chunk  Where to copy it.
+ * @param offset The offset of the part in the packet.
+ * @param size   The size of the part.
+ */
+void fifo_tx_fill(void *chunk, size_t offset, size_t size);
+
 /**
  * @brief Push the command for a message to send in the FIFO.
  *
@@ -53,9 +105,41 @@ extern uint8_t tx_buffer[164];
  */
 void fifo_push(uint16_t arg, uint8_t type);
 
+/**
+ * @brief Push the command for a message to send before all the others.
+ *
+ * @param arg    Arguments related to the type of the message.
+ * @param type   Type of the message.
+ */
+void fifo_push_first(uint16_t arg, uint8_t type);
+
 /**
  * @brief Pop a message from the fifo into tx_buffer.
  */
 int fifo_pop(void);
 
+/**
+ * @brief Remove a pending command from the fifo, if it is there.
+ *
+ * Used when an equivalent packet has been overheard from a neighbour, so that
+ * we do not broadcast it a second time.
+ *
+ * @param arg    Arguments related to the type of the message.
+ * @param type   Type of the message.
+ */
+void fifo_cancel(uint16_t arg, uint8_t type);
+
+/**
+ * @brief Signal that a neighbour has just broadcast the same roots as ours.
+ */
+void fifo_root_heard(void);
+
+/**
+ * @brief Send ROOTs at the fastest pace again.
+ *
+ * To be called whenever our tree and a neighbour's differ, or when we insert
+ * a new message.
+ */
+void fifo_root_reset(void);
+
 #endif // __FIFO_H__
@@ -26,17 +26,120 @@
 #define __JUNGLE_H__
 
 #include <stdint.h>
+#include <stddef.h>
+
+#define PROTOCOL_VERSION 2
 
 #define NODE 0
 #define ROOT 1
 #define LEAF 2
 #define MESSAGE 3
+#define OFFER 4
+#define ACCEPT 5
+#define DATA 6
+#define ACK 7
+#define SINCE 8
+#define RECEIPT 9
+
+/**
+ * @brief Size of the header of every packet.
+ *
+ * byte 0: protocol version (4 bits), packet type (4 bits)
+ * byte 1: length of the packet, stripped of the header
+ * bytes 2-3: address of the WaDeD sending the packet
+ */
+#define HEADER_SIZE 4
+
+#define MESSAGE_HEADER_SIZE 21
+#define MESSAGE_MAX_SIZE    (MESSAGE_HEADER_SIZE + 140)
+
+/**
+ * @brief Size of the fields preceding the message in a DATA packet.
+ */
+#define DATA_HEADER_SIZE 3
+
+/**
+ * @brief Size of the largest packet, header included.
+ */
+#define PACKET_MAX_SIZE (HEADER_SIZE + DATA_HEADER_SIZE + MESSAGE_MAX_SIZE)
+
+/**
+ * @brief Our address, put in the header of the packets we send.
+ */
+extern uint16_t node_address;
+
+/**
+ * @brief Initialise the protocol, computing our address from the unique ID of
+ * the MCU.
+ */
+void jungle_init(void);
+
+/**
+ * @brief Take the state of the protocol, shared by the threads receiving,
+ * sending and talking to the host. Everything below needs it, but
+ * jungle_filter.
+ *
+ * @note  It is taken before tree_mtx, and the threads receiving and sending
+ * do not hold it while waiting for the radio.
+ */
+void jungle_lock(void);
+
+/**
+ * @brief Give back the state of the protocol.
+ */
+void jungle_unlock(void);
+
+struct Bucket;
+
+/**
+ * @brief Store a message, counting it against the quota of its source.
+ *
+ * @param b The message.
+ *
+ * @return Its address in FRAM, or MEM_FULL.
+ */
+uint16_t jungle_store(struct Bucket *b);
+
+/**
+ * @brief Erase a stored message, and withdraw it from the fifo and the
+ * session sending it, which would otherwise send a freed bucket.
+ *
+ * @param address The address of the message in FRAM.
+ */
+void jungle_evict(uint16_t address);
+
+struct Packet;
 
 /**
  * @brief Handles a recieved packet, chooses what has to be sent in response.
  *
- * @param buf Pointer towards a received buffer.
+ * @note  The buffer of the packet is reused to store a MESSAGE: its content
+ * is lost.
+ *
+ * @param packet The packet received.
+ */
+void handle_packet(struct Packet *packet);
+
+/**
+ * @brief Decide from its first bytes whether a packet being received is worth
+ * receiving entirely. A message we already have is not.
+ *
+ * It does not wait for the memory, and may be called from the radio thread
+ * while the packet is being received.
+ *
+ * @param head The first bytes of the packet.
+ * @param size Their number.
+ *
+ * @return 1 to receive the rest of the packet, 0 to drop it.
+ */
+int jungle_filter(const void *head, size_t size);
+
+/**
+ * @brief Handle a packet dropped by jungle_filter, as handle_packet would
+ * have done once it was fully received.
+ *
+ * @param packet The packet, of which only the first bytes have been received.
  */
-void handle_packet(const void *buf);
+void handle_dropped(struct Packet *packet);
 
 #endif // __JUNGLE_H__
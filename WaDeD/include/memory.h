@@ -128,6 +128,13 @@ uint16_t memory_get_ids_head(uint16_t id);
  */
 uint16_t memory_get_timestamps_head(void);
 
+/**
+ * @brief Returns the head of the emission list, the message emitted last.
+ *
+ * @return Head of the emission list.
+ */
+uint16_t memory_get_emission_head(void);
+
 /**
  * @brief Insert new_packet into the memory.
  *
@@ -149,9 +156,21 @@ void memory_erase_bucket(uint16_t address);
  */
 void memory_clean(void);
 
+/**
+ * @brief Skip the local messages of an id list.
+ *
+ * @param address A bucket of the list.
+ *
+ * @return The first bucket of the list from address on that is part of the
+ * trees.
+ */
+uint16_t memory_skip_local(uint16_t address);
+
 /**
  * @brief Computes the hash of a leaf, depending on the associated list.
  *
+ * Local messages are not taken into account.
+ *
  * @param id Handler identifier.
  *
  * @return The hash of the list. 0 if there is no element in the list.
@@ -0,0 +1,189 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  neighbour.h
+ * @brief Keep track of the WaDeDs we hear, and of their synchronisation.
+ */
+
+#ifndef __NEIGHBOUR_H__
+#define __NEIGHBOUR_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+#include "route.h"
+
+#define NEIGHBOUR_MAX 8
+
+/**
+ * @brief Time after which a silent neighbour is forgotten.
+ */
+#define NEIGHBOUR_TIMEOUT S2ST(300)
+
+/**
+ * @brief Time during which we do not start a new descent with a neighbour
+ * whose roots did not change, for a stone. See struct Role.
+ */
+#define NEIGHBOUR_RESYNC S2ST(30)
+
+/**
+ * @brief Averaged RSSI, in -0.5 dBm, under which a link is strong enough for
+ * the fast rate.
+ */
+#ifndef NEIGHBOUR_FAST_RSSI
+#define NEIGHBOUR_FAST_RSSI 160
+#endif
+
+/**
+ * @brief Loss rate, in 1/256, above which a link falls back to the slow rate,
+ * and under which it goes back to the fast one.
+ */
+#define NEIGHBOUR_LOSS_SLOW 64
+#define NEIGHBOUR_LOSS_FAST 16
+
+/**
+ * @brief Averaged RSSI, in -0.5 dBm, above which a link is weak enough to be
+ * coded, see fec.h.
+ */
+#ifndef NEIGHBOUR_FEC_RSSI
+#define NEIGHBOUR_FEC_RSSI 190
+#endif
+
+// Flags of struct Neighbour state.
+#define NEIGHBOUR_USED     0x01
+#define NEIGHBOUR_IN_SYNC  0x02
+#define NEIGHBOUR_CATCH_UP 0x04 /**< Heard again after we were alone. */
+#define NEIGHBOUR_SLOW     0x08 /**< Losing too many packets at fast rate. */
+
+/**
+ * @brief What we know about a neighbour.
+ */
+struct Neighbour {
+    uint16_t  address;
+    uint8_t   state;
+    uint8_t   rssi;      // RSSI of its packets, averaged, in -0.5 dBm.
+    uint8_t   loss;      // Share of our DATA packets it missed, in 1/256.
+    uint8_t   roots[16]; // The last roots it advertised.
+    systime_t last_seen; // Last time we heard it.
+    systime_t last_sync; // Last time we started a descent because of it.
+    uint8_t   demand;    // Messages it requested since it was last in sync
+                         // with us.
+    uint8_t   filter[ROUTE_FILTER_SIZE]; // The addresses reachable through it.
+};
+
+/**
+ * @brief Record that a packet has been received from a neighbour.
+ *
+ * If the neighbour is unknown, it takes the place of the neighbour we have
+ * not heard for the longest time. If we heard nobody for NEIGHBOUR_TIMEOUT
+ * before it, it is marked NEIGHBOUR_CATCH_UP.
+ *
+ * @param address The source address of the packet.
+ * @param rssi    The RSSI of the packet.
+ *
+ * @return The entry of the neighbour.
+ */
+struct Neighbour *neighbour_heard(uint16_t address, uint8_t rssi);
+
+/**
+ * @brief Find a neighbour in the table.
+ *
+ * @param address The address of the neighbour.
+ *
+ * @return Its entry, or NULL if it is unknown.
+ */
+struct Neighbour *neighbour_find(uint16_t address);
+
+/**
+ * @brief Record how many of the DATA packets sent to a neighbour it received,
+ * as told by its ACKs.
+ *
+ * @param address   The address of the neighbour.
+ * @param delivered The number of packets received.
+ * @param lost      The number of packets lost.
+ */
+void neighbour_delivery(uint16_t address, uint8_t delivered, uint8_t lost);
+
+/**
+ * @brief Tell whether the link with a neighbour is good enough for the fast
+ * rate: it is heard loud enough, and did not lose too many packets.
+ *
+ * @param address The address of the neighbour.
+ *
+ * @return 1 if it is, 0 if not or if the neighbour is unknown.
+ */
+int neighbour_fast(uint16_t address);
+
+/**
+ * @brief Tell whether the link with a neighbour needs to be coded: it is
+ * heard faintly, or it fell back to the slow rate and still loses packets.
+ *
+ * @param address The address of the neighbour.
+ *
+ * @return 1 if it does, 0 if not or if the neighbour is unknown.
+ */
+int neighbour_fec(uint16_t address);
+
+/**
+ * @brief Record that a neighbour advertised the same roots as ours.
+ *
+ * @param n The neighbour.
+ */
+void neighbour_synced(struct Neighbour *n);
+
+/**
+ * @brief Decide whether a descent should be started with a neighbour whose
+ * roots differ from ours.
+ *
+ * A descent is not restarted while the neighbour's roots and ours did not
+ * change since the previous one, unless the resync delay of our role
+ * elapsed.
+ *
+ * @param n     The neighbour.
+ * @param roots The roots it advertised.
+ *
+ * @return 1 if the descent should be started, 0 if not.
+ */
+int neighbour_should_sync(struct Neighbour *n, const void *roots);
+
+/**
+ * @brief Record that our tree has changed, so every neighbour has to be
+ * compared again.
+ */
+void neighbour_tree_changed(void);
+
+/**
+ * @brief Tell whether an address is reachable through one of the neighbours
+ * we currently hear.
+ *
+ * @param address The address.
+ *
+ * @return 1 if it probably is, 0 if not.
+ */
+int neighbour_reaches(uint16_t address);
+
+/**
+ * @brief Tell whether all the neighbours we currently hear agree with us.
+ *
+ * @return 1 if they all advertised our roots, 0 if not.
+ */
+int neighbour_all_synced(void);
+
+#endif // __NEIGHBOUR_H__
@@ -0,0 +1,114 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  packet.h
+ * @brief Packet buffers, passed by pointer from the radio to the protocol.
+ *
+ * The buffers come from a memory pool of PACKET_BUFFERS. A packet has a
+ * single owner: the radio thread hands it on to the main thread, which gives
+ * it back with packet_release once handled. Nothing keeps a packet after
+ * handle_packet, the messages to store being copied to the memory.
+ *
+ * A packet is received PACKET_HEADROOM bytes into its buffer, so that the text
+ * of a MESSAGE lies where it would in a struct Bucket: the bucket to store is
+ * then built around it, over the headers which have been parsed.
+ */
+
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ch.h"
+#include "jungle.h"
+#include "bucket.h"
+#include "fec.h"
+
+/**
+ * @brief Number of packets that can be received while the previous ones are
+ * being handled.
+ */
+#ifndef PACKET_BUFFERS
+#define PACKET_BUFFERS 2
+#endif
+
+/**
+ * @brief Size of the largest packet received, coded if built with __FEC__.
+ */
+#ifdef __FEC__
+#define PACKET_RX_SIZE (PACKET_MAX_SIZE + FEC_OVERHEAD)
+#else
+#define PACKET_RX_SIZE PACKET_MAX_SIZE
+#endif
+
+/**
+ * @brief Room left in front of the packet, so that the text of a MESSAGE is
+ * at the offset of the text of a bucket.
+ */
+#define PACKET_HEADROOM (offsetof(struct Bucket, message) \
+                         - HEADER_SIZE - MESSAGE_HEADER_SIZE)
+
+/**
+ * @brief A packet received.
+ */
+struct Packet {
+    int     size; /**< The size of the packet, or SX1231_ERR. */
+    uint8_t rssi; /**< The RSSI at which it has been received. */
+    union {
+        struct Bucket bucket; /**< Built by handle_packet from a MESSAGE. */
+        uint8_t room [PACKET_HEADROOM + PACKET_RX_SIZE];
+    } u;
+};
+
+/**
+ * @brief Get the first byte of a packet.
+ *
+ * @param packet The packet.
+ *
+ * @return Its header.
+ */
+static inline uint8_t *packet_data(struct Packet *packet)
+{
+    return packet->u.room + PACKET_HEADROOM;
+}
+
+/**
+ * @brief Fill the pool of packets.
+ */
+void packet_init(void);
+
+/**
+ * @brief Take a free packet.
+ *
+ * @param timeout The time during which we wait for one to be released.
+ *
+ * @return The packet, or NULL if none has been released in time.
+ */
+struct Packet *packet_alloc(systime_t timeout);
+
+/**
+ * @brief Give a packet back to the pool.
+ *
+ * @param packet The packet.
+ */
+void packet_release(struct Packet *packet);
+
+#endif // __PACKET_H__
@@ -0,0 +1,76 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  power.h
+ * @brief Put the MCU in a low power mode while all the threads wait.
+ *
+ * The idle thread sleeps until the next interrupt, or enters the stop mode
+ * when the next virtual timer is at least POWER_STOP_MIN away and neither the
+ * USB nor an SPI transfer needs the clocks. The system time is made up for
+ * the ticks missed in stop when it ends, on a DIO of the SX1231 or on the RTC
+ * wakeup timer.
+ */
+
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+#include "fram.h"
+
+/**
+ * @brief Shortest wait worth entering the stop mode, which costs the restart
+ * of the clocks.
+ */
+#ifndef POWER_STOP_MIN
+#define POWER_STOP_MIN MS2ST(50)
+#endif
+
+/**
+ * @brief Time spent in each power state since boot, in ticks.
+ */
+struct PowerStats {
+    systime_t run;
+    systime_t sleep;
+    systime_t stop;
+    uint32_t  stops; // Number of times the stop mode has been entered.
+    struct FramStats fram;
+};
+
+/**
+ * @brief Start the RTC wakeup timer.
+ */
+void power_init(void);
+
+/**
+ * @brief Wait for the next interrupt in the lowest power mode allowed. Called
+ * by the idle thread.
+ */
+void power_idle(void);
+
+/**
+ * @brief Get the time spent in each power state, by the MCU and by the FRAM.
+ *
+ * @param stats Filled with the times.
+ */
+void power_stats(struct PowerStats *stats);
+
+#endif // __POWER_H__
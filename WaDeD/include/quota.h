@@ -0,0 +1,88 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  quota.h
+ * @brief Per-source quotas, sharing the memory fairly between the sources.
+ *
+ * The number of stored messages of each source is tracked. When the memory is
+ * full, a new message gets in by evicting a message of the source which
+ * exceeds its quota the most, unless this is its own source.
+ */
+
+#ifndef __QUOTA_H__
+#define __QUOTA_H__
+
+#include <stdint.h>
+
+#include "bucket.h"
+
+/**
+ * @brief Number of sources tracked. The messages of the others are not
+ * counted.
+ */
+#define QUOTA_SOURCES 32
+
+/**
+ * @brief Number of messages a source may store before it becomes the first
+ * to be evicted.
+ */
+#ifndef QUOTA_DEFAULT
+#define QUOTA_DEFAULT (MEM_SIZE / 8)
+#endif
+
+/**
+ * @brief Count a message stored. See jungle_store.
+ *
+ * @param source The source address of the message.
+ */
+void quota_add(uint16_t source);
+
+/**
+ * @brief Count a message erased. See jungle_evict.
+ *
+ * @param source The source address of the message.
+ */
+void quota_remove(uint16_t source);
+
+/**
+ * @brief Forget all the counts, when the memory is cleaned.
+ */
+void quota_reset(void);
+
+/**
+ * @brief Set the quota of a source.
+ *
+ * @param source The source address.
+ * @param limit  The number of messages it may store.
+ */
+void quota_set(uint16_t source, uint16_t limit);
+
+/**
+ * @brief Decide whether a message is to be stored, making room for it if the
+ * memory is full.
+ *
+ * @param b The message.
+ *
+ * @return 0 if its source exceeds its quota the most, 1 otherwise. The
+ * insertion may still fail if the memory is full and nobody exceeds its quota.
+ */
+int quota_admit(const struct Bucket *b);
+
+#endif // __QUOTA_H__
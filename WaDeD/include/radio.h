@@ -0,0 +1,153 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  radio.h
+ * @brief Drive the SX1231 from a thread of its own.
+ *
+ * The radio thread keeps the SX1231 listening whenever it has nothing to
+ * send. The packets received are queued to the protocol thread, which waits
+ * for them with radio_wait, while the packets to send are submitted by the
+ * transmit thread, which waits for their end in radio_send. Receiving thus
+ * goes on while the previous packets are handled and the next one prepared.
+ *
+ * Built with __LOW_POWER__, the SX1231 sleeps once nothing has been heard nor
+ * sent for RADIO_LPL_AWAKE, and only wakes up every RADIO_LPL_PERIOD to sniff
+ * for DASH7 background frames during RADIO_LPL_SNIFF. Before sending to a
+ * neighbourhood which may be asleep, background frames are sent during a
+ * whole period, each telling when the packet will follow, so that every
+ * neighbour catches one and wakes up in time for it.
+ */
+
+#ifndef __RADIO_H__
+#define __RADIO_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+#include "sx1231.h"
+#include "jungle.h"
+#include "fec.h"
+#include "packet.h"
+
+/**
+ * @brief Duration of a backoff slot.
+ */
+#ifndef RADIO_SLOT
+#define RADIO_SLOT MS2ST(2)
+#endif
+
+/**
+ * @brief Time during which the channel is listened to before sending.
+ */
+#ifndef RADIO_CCA_TIME
+#define RADIO_CCA_TIME MS2ST(1)
+#endif
+
+/**
+ * @brief Number of times the channel is found busy before giving up a packet.
+ */
+#ifndef RADIO_TX_RETRIES
+#define RADIO_TX_RETRIES 6
+#endif
+
+/**
+ * @brief Period at which a sleeping radio sniffs for background frames: the
+ * latency of the wake-up.
+ */
+#ifndef RADIO_LPL_PERIOD
+#define RADIO_LPL_PERIOD S2ST(1)
+#endif
+
+/**
+ * @brief Time during which a sleeping radio sniffs, long enough for two
+ * background frames.
+ */
+#ifndef RADIO_LPL_SNIFF
+#define RADIO_LPL_SNIFF MS2ST(6)
+#endif
+
+/**
+ * @brief Time after the last packet heard or sent during which the radio
+ * stays awake.
+ */
+#ifndef RADIO_LPL_AWAKE
+#define RADIO_LPL_AWAKE S2ST(10)
+#endif
+
+/**
+ * @defgroup RADIO_CLASS
+ * @brief Contention classes: the lower, the shorter the backoff.
+ * @{
+ */
+#define RADIO_URGENT 0 /**< Replies a neighbour is waiting for. */
+#define RADIO_NORMAL 1 /**< Synchronisation. */
+#define RADIO_BULK   2 /**< Messages. */
+/** @} */
+
+/**
+ * @defgroup RADIO_EVENT
+ * @{
+ */
+#define RADIO_TIMEOUT  0 /**< Nothing happened. */
+#define RADIO_RECEIVED 1 /**< A packet has been received. */
+/** @} */
+
+/**
+ * @brief Start the radio thread. The SX1231 must have been initialised.
+ */
+void radio_init(void);
+
+/**
+ * @brief Send a packet, and wait until it has been sent or given up. Only one
+ * thread may send.
+ *
+ * The packet is sent after a random backoff, chosen in a contention window
+ * depending on its class, when the channel is clear. Each time the channel is
+ * found busy, the window doubles, and after RADIO_TX_RETRIES the packet is
+ * given up with CHANNEL_BUSY. The radio keeps receiving meanwhile.
+ *
+ * @param size    The size of the packet.
+ * @param fill    The function fetching its chunks.
+ * @param class   RADIO_CLASS
+ * @param session Whether it is a DATA or an ACK, sent on the channel given by
+ *                channel_now rather than on CHANNEL_RENDEZVOUS.
+ *
+ * @return SX1231_ERR
+ */
+int radio_send(size_t size, tx_fill_t fill, int class, int session);
+
+/**
+ * @brief Wait for the radio to receive a packet.
+ *
+ * @param timeout The time during which we wait.
+ * @param rx      Where to put the packet received, to be released with
+ *                packet_release once handled.
+ *
+ * @return RADIO_EVENT
+ */
+int radio_wait(systime_t timeout, struct Packet **rx);
+
+/**
+ * @brief Have the radio thread check the channel it should be on, see
+ * channel_now.
+ */
+void radio_retune(void);
+
+#endif // __RADIO_H__
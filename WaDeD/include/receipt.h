@@ -0,0 +1,96 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  receipt.h
+ * @brief Delivery receipts, to free the messages delivered to their host.
+ *
+ * When a message is delivered to its destination host, the WaDeD delivering
+ * it erases it and broadcasts a receipt with its id. Every WaDeD learning a
+ * receipt erases the message too, broadcasts the receipt once, and keeps a
+ * tombstone until the message expires so that it is not synchronised back.
+ */
+
+#ifndef __RECEIPT_H__
+#define __RECEIPT_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+
+/**
+ * @brief Number of tombstones kept.
+ */
+#define TOMBSTONE_MAX 32
+
+/**
+ * @brief Longest time during which a tombstone is kept, in ms: the life of a
+ * message. A later expiration date is not trusted.
+ */
+#define TOMBSTONE_LIFE (24 * 60 * 60 * 1000)
+
+/**
+ * @brief Maximum number of receipts in a RECEIPT packet.
+ */
+#define RECEIPT_BATCH 13
+
+/**
+ * @brief Record that a message has been delivered to our host.
+ *
+ * The message is erased, and a receipt is queued.
+ *
+ * @param id         The id of the message.
+ * @param expiration Its expiration date, until which the tombstone is kept.
+ */
+void receipt_delivered(uint64_t id, uint32_t expiration);
+
+/**
+ * @brief Tell whether a message is known to be delivered.
+ *
+ * If it is, the receipt is queued again, for the neighbour which sent it
+ * obviously did not get it.
+ *
+ * @param id The id of the message.
+ *
+ * @return 1 if it is, 0 if not.
+ */
+int receipt_has(uint64_t id);
+
+/**
+ * @brief Handle the reception of a RECEIPT packet.
+ *
+ * @param buf The packet, stripped of its header.
+ * @param length Its size.
+ */
+void receipt_handle(const void *buf, uint8_t length);
+
+/**
+ * @brief Write the receipts waiting to be sent, as in a RECEIPT packet.
+ *
+ * byte 0: number of receipts
+ * bytes 1+: the receipts, 12 bytes each: the id of the delivered message,
+ * then its expiration date
+ *
+ * @param body Where to write.
+ *
+ * @return The number of bytes written.
+ */
+uint8_t receipt_put(uint8_t *body);
+
+#endif // __RECEIPT_H__
@@ -0,0 +1,114 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  role.h
+ * @brief Profiles of the two kinds of WaDeD: stones and zombies.
+ *
+ * Stones are fixed and are the storage backbone of the network: they keep
+ * every message, send their ROOTs slowly and serve sessions readily. Zombies
+ * are carried by their host: they keep the messages from and to it, plus a
+ * bounded cache of messages to relay, and send their ROOTs often so that
+ * they are noticed while they move.
+ */
+
+#ifndef __ROLE_H__
+#define __ROLE_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+#include "memory.h"
+
+#define ROLE_STONE  0
+#define ROLE_ZOMBIE 1
+
+#ifndef DEFAULT_ROLE
+#define DEFAULT_ROLE ROLE_STONE
+#endif
+
+#ifndef ZOMBIE_ROOT_INTERVAL_MIN
+#define ZOMBIE_ROOT_INTERVAL_MIN MS2ST(500)
+#endif
+#ifndef ZOMBIE_ROOT_INTERVAL_MAX
+#define ZOMBIE_ROOT_INTERVAL_MAX S2ST(8)
+#endif
+
+/**
+ * @brief Number of messages a zombie stores before it evicts the messages to
+ * relay.
+ */
+#ifndef ZOMBIE_RELAY_CACHE
+#define ZOMBIE_RELAY_CACHE 128
+#endif
+
+/**
+ * @brief Time during which a zombie does not start the same descent again.
+ *
+ * Since it does not keep everything, a zombie rarely gets in sync with a
+ * stone, and would otherwise start a descent at each of its ROOTs.
+ */
+#define ZOMBIE_RESYNC S2ST(120)
+
+/**
+ * @brief The parameters depending on the role.
+ */
+struct Role {
+    systime_t root_interval_min; // Bounds of the period between our ROOTs.
+    systime_t root_interval_max;
+    systime_t resync;            // See NEIGHBOUR_RESYNC.
+    uint16_t  relay_cache;       // Messages stored before evicting relays.
+    uint8_t   session_threshold; // See SESSION_THRESHOLD.
+};
+
+/**
+ * @brief Change our role.
+ *
+ * @param role ROLE_STONE or ROLE_ZOMBIE.
+ */
+void role_set(uint8_t role);
+
+/**
+ * @brief Get our role.
+ *
+ * @return ROLE_STONE or ROLE_ZOMBIE.
+ */
+uint8_t role_get(void);
+
+/**
+ * @brief Get the parameters of our role.
+ *
+ * @return The profile.
+ */
+const struct Role *role_profile(void);
+
+/**
+ * @brief Decide whether a received message is to be stored.
+ *
+ * A stone stores everything. A zombie stores the messages from and to its
+ * host; the others are stored while it holds less than ZOMBIE_RELAY_CACHE
+ * messages, and then replace the relayed message expiring first.
+ *
+ * @param b The message.
+ *
+ * @return 1 if it is to be stored, 0 if not.
+ */
+int role_admit(const struct Bucket *b);
+
+#endif // __ROLE_H__
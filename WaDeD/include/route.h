@@ -0,0 +1,91 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  route.h
+ * @brief Summaries of the addresses reachable through each WaDeD.
+ *
+ * Each WaDeD keeps a Bloom filter of the addresses of the hosts recently
+ * connected to it, and gossips it in its ROOTs. Under __ROUTING__, the
+ * messages whose destination is in our filter or in a neighbour's are
+ * forwarded first, and kept at the expense of the others when the memory is
+ * full.
+ */
+
+#ifndef __ROUTE_H__
+#define __ROUTE_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+
+/**
+ * @brief Size of a filter, in bytes.
+ */
+#define ROUTE_FILTER_SIZE 16
+
+/**
+ * @brief Time after which an address leaves our filter, if not seen again.
+ *
+ * Addresses are kept in two generations of filters, each lasting
+ * ROUTE_PERIOD.
+ */
+#define ROUTE_PERIOD S2ST(600)
+
+/**
+ * @brief Number of buckets examined, the first to expire first, to find one
+ * to evict.
+ */
+#define ROUTE_EVICT_SCAN 32
+
+/**
+ * @brief Record that an address has been seen here.
+ *
+ * @param address The address of a host.
+ */
+void route_add(uint16_t address);
+
+/**
+ * @brief Put our filter in a buffer.
+ *
+ * @param buf A ROUTE_FILTER_SIZE bytes buffer.
+ */
+void route_get_filter(void *buf);
+
+/**
+ * @brief Test whether an address is in a filter.
+ *
+ * @param filter The filter.
+ * @param address The address.
+ *
+ * @return 1 if it is probably in the filter, 0 if it is not.
+ */
+int route_filter_has(const void *filter, uint16_t address);
+
+/**
+ * @brief Test whether a message to an address is likely to be delivered by us
+ * or by one of our neighbours.
+ *
+ * @param address The destination address.
+ *
+ * @return 1 if it is, 0 if not.
+ */
+int route_reachable(uint16_t address);
+
+#endif // __ROUTE_H__
@@ -0,0 +1,189 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  session.h
+ * @brief Unicast bulk-transfer sessions between two WaDeDs.
+ *
+ * When a descent shows that a neighbour misses many of our messages, we offer
+ * it a session. Once accepted, the messages are streamed in DATA packets with
+ * a sliding window, and the neighbour acknowledges them with ACK packets
+ * carrying a bitmap of what it received, so that only the missing ones are
+ * sent again.
+ */
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <stdint.h>
+
+#include "ch.h"
+
+/**
+ * @brief Number of messages requested by a neighbour since it was last in
+ * sync with us above which a stone offers it a session. See struct Role.
+ */
+#ifndef SESSION_THRESHOLD
+#define SESSION_THRESHOLD 8
+#endif
+
+/**
+ * @brief Number of DATA packets that can be sent without being acknowledged.
+ *
+ * Must not exceed 8, the size of the ACK bitmap.
+ */
+#define SESSION_WINDOW 8
+
+/**
+ * @brief Number of messages waiting to enter the window.
+ */
+#define SESSION_BACKLOG 64
+
+/**
+ * @brief Number of DATA packets received before we acknowledge them, if
+ * nothing is missing.
+ */
+#define SESSION_ACK_EVERY 4
+
+/**
+ * @brief Time after which unacknowledged packets are sent again.
+ */
+#define SESSION_ACK_TIMEOUT S2ST(3)
+
+/**
+ * @brief Number of times an OFFER or a window is sent again before we give up
+ * the session.
+ */
+#define SESSION_RETRIES 3
+
+/**
+ * @brief Time after which a receiving session with no DATA is closed.
+ */
+#define SESSION_IDLE_TIMEOUT S2ST(15)
+
+/**
+ * @brief Margin taken on the date of a SINCE request, in ms, for the clocks
+ * of the WaDeDs do not agree exactly.
+ */
+#define SINCE_MARGIN (10 * 60 * 1000)
+
+/**
+ * @brief Give messages to send to a neighbour to the session with it.
+ *
+ * The messages are taken if a session with this neighbour is already open, or
+ * if none is and open is set, in which case a session is offered to it.
+ *
+ * @param peer      The address of the neighbour.
+ * @param addresses The addresses in FRAM of the messages.
+ * @param n         The number of messages.
+ * @param open      Whether a new session may be offered.
+ *
+ * @return 1 if the messages have been taken, 0 if the caller has to send them.
+ */
+int session_push(uint16_t peer, const uint16_t *addresses, uint8_t n,
+                 int open);
+
+/**
+ * @brief Ask a neighbour for all the messages emitted since a given date.
+ *
+ * A SINCE packet is sent to the neighbour, which answers with a session
+ * carrying the messages, the newest first.
+ *
+ * @param peer  The address of the neighbour.
+ * @param since The emission date.
+ *
+ * @return 1 if the request is under way, 0 if we already receive from someone
+ * else.
+ */
+int session_request(uint16_t peer, uint32_t since);
+
+/**
+ * @brief Tell whether a neighbour is currently sending us messages in a
+ * session.
+ *
+ * @param peer The address of the neighbour.
+ *
+ * @return 1 if it is, 0 if not.
+ */
+int session_receiving(uint16_t peer);
+
+/**
+ * @brief Drop a message about to be erased from the sending session.
+ *
+ * It leaves the backlog, and an empty DATA is sent in its place if it is in
+ * the window.
+ *
+ * @param address The address of the message in FRAM.
+ */
+void session_forget(uint16_t address);
+
+/**
+ * @brief Prepare the next session packet in tx_buffer, if any.
+ *
+ * @return 1 if a packet has been put in tx_buffer, 0 if not.
+ */
+int session_pop(void);
+
+/**
+ * @brief Handle the reception of an OFFER packet.
+ *
+ * @param source The sender of the packet.
+ * @param buf    The packet, stripped of its header.
+ * @param length Its size.
+ */
+void session_handle_offer(uint16_t source, const void *buf, uint8_t length);
+
+/**
+ * @brief Handle the reception of a SINCE packet.
+ *
+ * @param source The sender of the packet.
+ * @param buf    The packet, stripped of its header.
+ * @param length Its size.
+ */
+void session_handle_since(uint16_t source, const void *buf, uint8_t length);
+
+/**
+ * @brief Handle the reception of an ACCEPT packet.
+ *
+ * @param source The sender of the packet.
+ * @param buf    The packet, stripped of its header.
+ * @param length Its size.
+ */
+void session_handle_accept(uint16_t source, const void *buf, uint8_t length);
+
+/**
+ * @brief Handle the reception of a DATA packet.
+ *
+ * Only the session part is handled; the message it carries has to be handled
+ * as a MESSAGE by the caller.
+ *
+ * @param source The sender of the packet.
+ * @param buf    The packet, stripped of its header.
+ */
+void session_handle_data(uint16_t source, const void *buf);
+
+/**
+ * @brief Handle the reception of an ACK packet.
+ *
+ * @param source The sender of the packet.
+ * @param buf    The packet, stripped of its header.
+ */
+void session_handle_ack(uint16_t source, const void *buf);
+
+#endif // __SESSION_H__
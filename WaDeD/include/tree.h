@@ -29,6 +29,12 @@
 #define HAS_NOT 0
 #define END_REACHED 0xFFFF
 
+/**
+ * @brief Largest number of messages of a list sent in answer to a LEAF. The
+ * others are found by the next comparison.
+ */
+#define LIST_SEND_MAX 64
+
 #include "memory.h"
 #include "hash.h"
 
@@ -40,6 +46,8 @@ void build_tree(void);
 /**
  * @brief Insert a bucket in memory and update the tree accordingly.
  *
+ * The tree is left untouched if the bucket is marked BUCKET_LOCAL.
+ *
  * @param b A pointer to the bucket to be inserted.
  *
  * @return The address of the newly inserted bucket in FRAM.
@@ -97,11 +105,12 @@ uint64_t get_leaf_hash(uint16_t leaf);
  * @brief Put the hashes of a given list in a buffer.
  *
  * @param leaf The leaf pointing to the list.
- * @param buffer The buffer in which to store the hashes.
+ * @param buffer The buffer in which to store the hashes, with no alignment
+ * required.
  *
  * @return The number of 8-bytes hashes put in the buffer.
  */
-int get_list(uint16_t leaf, uint64_t *buffer);
+int get_list(uint16_t leaf, uint8_t *buffer);
 
 /**
  * @brief Compare the hashes of a received list and the internal list.
@@ -109,17 +118,80 @@ int get_list(uint16_t leaf, uint64_t *buffer);
  * @param leaf The leaf pointing to the list.
  * @param buf A buffer containing the hashes of the distant list.
  * @param list_size The size of the distant list.
+ * @param out Where to place the addresses of the buckets to be sent.
  *
- * @return The number of messages to be sent.
+ * @return The number of messages to be sent, at most LIST_SEND_MAX.
  *
- * The first hash of the distant list is located at buf + 8. The function
- * places the addresses of the buckets to be sent in the buffer on 16-bits
- * integers, starting at buf.
+ * The first hash of the distant list is located at buf + 8.
  */
-uint8_t cmp_lists(uint16_t leaf, void *buf, uint8_t list_size);
+uint8_t cmp_lists(uint16_t leaf, const void *buf, uint8_t list_size,
+                  uint16_t *out);
 
 int tree_has_message(uint64_t id);
 
+/**
+ * @brief Find where a message is stored.
+ *
+ * @param id The id of the message.
+ *
+ * @return The address of its bucket in FRAM, or END_REACHED if we do not have
+ * it.
+ */
+uint16_t tree_find_message(uint64_t id);
+
+/**
+ * @brief Find where a message is stored, without waiting for the memory if
+ * it is being used.
+ *
+ * @param id The id of the message.
+ *
+ * @return The address of its bucket in FRAM, or END_REACHED if we do not have
+ * it or the memory is busy.
+ */
+uint16_t tree_peek_message(uint64_t id);
+
+/**
+ * @brief Erase a message from memory and update the tree accordingly.
+ *
+ * @param address The address of its bucket in FRAM.
+ */
+void tree_erase(uint16_t address);
+
+/**
+ * @brief Find a message to evict when the memory is full.
+ *
+ * Among the messages expiring first, the first one which is not wanted is
+ * chosen.
+ *
+ * @param wanted Tell whether the messages between a source and a destination
+ * should be kept.
+ * @param scan   The number of messages examined, MEM_SIZE for all of them.
+ *
+ * @return The address of the message, or END_REACHED if none was found.
+ */
+uint16_t tree_evictable(int (*wanted)(uint16_t source, uint16_t destination),
+                        int scan);
+
+/**
+ * @brief Walk the messages by decreasing emission date, skipping the local
+ * ones.
+ *
+ * @param address The current message, or END_REACHED to start with the
+ * message emitted last.
+ * @param since The oldest emission date wanted.
+ *
+ * @return The address of the next message emitted at or after since, or
+ * END_REACHED.
+ */
+uint16_t tree_next_emitted(uint16_t address, uint32_t since);
+
+/**
+ * @brief Get the emission date of the message emitted last.
+ *
+ * @return Its emission date, or 0 if the memory is empty.
+ */
+uint32_t tree_last_emission(void);
+
 void tree_reset(void);
 
 /**
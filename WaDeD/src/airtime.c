@@ -0,0 +1,123 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  airtime.c
+ * @brief Keep our airtime within the duty cycle allowed in the 433 MHz band.
+ */
+
+#include "airtime.h"
+#include "channel.h"
+#include "jungle.h"
+
+#define unless(x) if(!(x))
+
+#define SLOT_LENGTH (AIRTIME_WINDOW / AIRTIME_SLOTS)
+
+/**
+ * @brief Budget of the device over the window, all the channels together, in
+ * us.
+ */
+#define BUDGET \
+    ((uint32_t) (AIRTIME_WINDOW / CH_FREQUENCY) * AIRTIME_DUTY * 1000)
+
+//USE_MEMORY
+static uint32_t used [AIRTIME_FREQUENCIES][AIRTIME_SLOTS]; // In us.
+static uint32_t current_slot = 0; // Number of the current slot since boot.
+
+/**
+ * @brief Clear the slots which left the window. Call with the system locked.
+ */
+static void slide(void)
+{
+    uint32_t slot = chTimeNow() / SLOT_LENGTH;
+    for(int n = 0; current_slot != slot && n < AIRTIME_SLOTS; n++) {
+        current_slot++;
+        for(int f = 0; f < AIRTIME_FREQUENCIES; f++)
+            used[f][current_slot % AIRTIME_SLOTS] = 0;
+    }
+    current_slot = slot;
+}
+
+void airtime_spent(uint8_t channel, size_t size)
+{
+    // 55.555 kbaud, or 200 kbaud in the classes above the hi-rate one.
+    uint32_t bits = (size + AIRTIME_OVERHEAD) * 8;
+    uint32_t us   = ((channel & ~CHANNEL_FEC) >> 4) <= 2 ? bits * 18 : bits * 5;
+
+    chSysLock();
+    slide();
+    used[(channel & 0x0F) % AIRTIME_FREQUENCIES]
+        [current_slot % AIRTIME_SLOTS] += us;
+    chSysUnlock();
+}
+
+uint32_t airtime_used(uint8_t channel)
+{
+    uint32_t total = 0;
+
+    chSysLock();
+    slide();
+    for(int s = 0; s < AIRTIME_SLOTS; s++)
+        total += used[(channel & 0x0F) % AIRTIME_FREQUENCIES][s];
+    chSysUnlock();
+
+    return total;
+}
+
+uint32_t airtime_total(void)
+{
+    uint32_t total = 0;
+
+    chSysLock();
+    slide();
+    for(int f = 0; f < AIRTIME_FREQUENCIES; f++)
+        for(int s = 0; s < AIRTIME_SLOTS; s++)
+            total += used[f][s];
+    chSysUnlock();
+
+    return total;
+}
+
+int airtime_affords(uint32_t us)
+{
+    return airtime_total() + us <= BUDGET;
+}
+
+int airtime_allows(uint8_t type)
+{
+    uint32_t share;
+    switch(type) {
+        case ROOT:
+            share = AIRTIME_ROOT_SHARE;
+            break;
+        case NODE:
+        case LEAF:
+        case OFFER:
+        case SINCE:
+        case RECEIPT:
+            share = AIRTIME_SYNC_SHARE;
+            break;
+        default:
+            share = 100;
+            break;
+    }
+
+    return airtime_total() < BUDGET / 100 * share;
+}
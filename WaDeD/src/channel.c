@@ -0,0 +1,305 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  channel.c
+ * @brief Choice of the radio channel.
+ */
+
+#include "channel.h"
+#include "radio.h"
+
+#define unless(x) if(!(x))
+
+/**
+ * @brief Distance between two centre frequencies, in kHz.
+ */
+#define SPACING 108
+
+/**
+ * @brief Half the width of the channel filter of each class, in kHz, as set
+ * by select_channel.
+ */
+#define SLOW_FILTER 83
+#define FAST_FILTER 200
+
+/**
+ * @brief The data channels of each class, the slow ones first: centre
+ * frequencies far enough apart for the filter of the class that neighbouring
+ * channels of a class do not overlap, nor the rendezvous channel. At the slow
+ * rate, this is one out of two; at the fast rate, only the two DASH7 blink
+ * channels fit in the band.
+ */
+static const uint8_t data_channels [CHANNEL_DATA_COUNT] = {
+    CHANNEL_SLOW | 0x1, CHANNEL_SLOW | 0x3, CHANNEL_SLOW | 0x5,
+    CHANNEL_SLOW | 0x9, CHANNEL_SLOW | 0xB, CHANNEL_SLOW | 0xD,
+    CHANNEL_FAST | 0x2, CHANNEL_FAST | 0xC
+};
+
+/**
+ * @brief Number of times each data channel, or one of the other class
+ * overlapping it, has been found busy, halved at each proposal so that old
+ * observations fade.
+ */
+static volatile uint8_t busy [CHANNEL_DATA_COUNT];
+
+/**
+ * @brief Rotates the proposals between equally busy channels.
+ */
+static uint8_t turn = 0;
+
+/**
+ * @brief The data channel joined, whether it is coded, and the sessions on
+ * it.
+ */
+static uint8_t data_fec;
+static uint8_t data_index;
+static uint8_t users    = 0;
+static uint8_t deferred = 0; // 1 if the move waits for the end of a packet.
+
+/**
+ * @brief Read by the radio thread: whether we are on the data channel, since
+ * when, and when a session packet was last sent or received.
+ */
+static volatile uint8_t   on_data = 0;
+static volatile systime_t start;
+static volatile systime_t live;
+
+/**
+ * @brief Find a data channel.
+ *
+ * @param channel The channel.
+ *
+ * @return Its index in data_channels, or -1 if it is not a data channel.
+ */
+static int data_find(uint8_t channel)
+{
+#ifndef __FEC__
+    // We cannot decode them.
+    if(channel & CHANNEL_FEC)
+        return -1;
+#endif // __FEC__
+    for(int i = 0; i < CHANNEL_DATA_COUNT; i++)
+        if(data_channels[i] == (channel & ~CHANNEL_FEC))
+            return i;
+    return -1;
+}
+
+/**
+ * @brief Get the data channels of a class.
+ *
+ * @param fast  Whether it is the fast class.
+ * @param count Set to their number.
+ *
+ * @return The index of the first one in data_channels.
+ */
+static int data_class(int fast, int *count)
+{
+    *count = fast ? CHANNEL_FAST_COUNT : CHANNEL_SLOW_COUNT;
+    return fast ? CHANNEL_SLOW_COUNT : 0;
+}
+
+/**
+ * @brief Get the distance between the centre frequencies of two channels.
+ *
+ * @param a The first channel.
+ * @param b The second one.
+ *
+ * @return The distance, in kHz.
+ */
+static int distance(uint8_t a, uint8_t b)
+{
+    int d = SPACING * ((a & 0x0F) - (b & 0x0F));
+    return d < 0 ? -d : d;
+}
+
+/**
+ * @brief Tell whether the spectrums of two data channels overlap.
+ *
+ * @param a The first channel, without CHANNEL_FEC.
+ * @param b The second one.
+ *
+ * @return 1 if they do, 0 if not.
+ */
+static int overlap(uint8_t a, uint8_t b)
+{
+    int width = ((a & 0xF0) == CHANNEL_FAST ? FAST_FILTER : SLOW_FILTER)
+              + ((b & 0xF0) == CHANNEL_FAST ? FAST_FILTER : SLOW_FILTER);
+    return distance(a, b) < width;
+}
+
+/**
+ * @brief Move to the data channel now.
+ */
+static void move(void)
+{
+    deferred = 0;
+    start    = chTimeNow();
+    live     = start;
+    on_data  = 1;
+    radio_retune();
+}
+
+uint8_t channel_propose(int fast, int fec)
+{
+    if(users)
+        return data_fec | data_channels[data_index];
+
+    // Start from a different channel on each WaDeD, so that neighbourhoods
+    // spread over the channels even when nothing is busy yet.
+    int count;
+    int first = data_class(fast, &count);
+    int best  = first + (node_address + turn++) % count;
+    for(int i = first; i < first + count; i++)
+        if(busy[i] < busy[best])
+            best = i;
+    for(int i = 0; i < CHANNEL_DATA_COUNT; i++)
+        busy[i] /= 2;
+    uint8_t channel = data_channels[best];
+#ifdef __FEC__
+    if(fec)
+        channel |= CHANNEL_FEC;
+#else
+    (void) fec;
+#endif // __FEC__
+    return channel;
+}
+
+uint8_t channel_robust(uint8_t channel, int fast, int fec)
+{
+    if(data_find(channel) < 0)
+        return channel;
+
+    // The slow channel nearest to the fast one.
+    if(!fast && (channel & ~CHANNEL_FEC & 0xF0) == CHANNEL_FAST) {
+        int nearest = 0;
+        for(int i = 1; i < CHANNEL_SLOW_COUNT; i++)
+            if(distance(data_channels[i], channel)
+                    < distance(data_channels[nearest], channel))
+                nearest = i;
+        channel = (channel & CHANNEL_FEC) | data_channels[nearest];
+    }
+#ifdef __FEC__
+    if(fec)
+        channel |= CHANNEL_FEC;
+#else
+    (void) fec;
+#endif // __FEC__
+    return channel;
+}
+
+int channel_join(uint8_t channel, int later)
+{
+    int i = data_find(channel);
+    if(i < 0)
+        return 0;
+
+    if(users) {
+#ifdef __HOPPING__
+        return 0;
+#else
+        unless(i == data_index && (channel & CHANNEL_FEC) == data_fec)
+            return 0;
+        users++;
+        return 1;
+#endif // __HOPPING__
+    }
+
+    data_fec   = channel & CHANNEL_FEC;
+    data_index = i;
+    users      = 1;
+    if(later)
+        deferred = 1;
+    else
+        move();
+    return 1;
+}
+
+void channel_leave(void)
+{
+    unless(users)
+        return;
+    if(--users)
+        return;
+
+    deferred = 0;
+    on_data  = 0;
+    radio_retune();
+}
+
+void channel_sent(int session)
+{
+    if(deferred)
+        move();
+    else if(session)
+        channel_active();
+}
+
+void channel_active(void)
+{
+    unless(on_data)
+        return;
+
+    systime_t now = chTimeNow();
+    int quiet = (systime_t) (now - live) >= CHANNEL_QUIET;
+    live = now;
+    if(quiet)
+        radio_retune();
+}
+
+uint8_t channel_now(systime_t *left)
+{
+    *left = TIME_INFINITE;
+    unless(on_data)
+        return CHANNEL_RENDEZVOUS;
+
+    // The sessions pause: be where the others are meanwhile.
+    systime_t now   = chTimeNow();
+    systime_t quiet = now - live;
+    if(quiet >= CHANNEL_QUIET)
+        return CHANNEL_RENDEZVOUS;
+    *left = CHANNEL_QUIET - quiet;
+
+#ifdef __HOPPING__
+    // Hop among the channels of the class.
+    int count;
+    int first = data_class((data_channels[data_index] & 0xF0) == CHANNEL_FAST,
+                           &count);
+    systime_t elapsed = now - start;
+    if(CHANNEL_DWELL - elapsed % CHANNEL_DWELL < *left)
+        *left = CHANNEL_DWELL - elapsed % CHANNEL_DWELL;
+    return data_fec | data_channels[first + (data_index - first
+                                             + elapsed / CHANNEL_DWELL)
+                                            % count];
+#else
+    return data_fec | data_channels[data_index];
+#endif // __HOPPING__
+}
+
+void channel_busy(uint8_t channel)
+{
+    if(data_find(channel) < 0)
+        return;
+    channel &= ~CHANNEL_FEC;
+
+    // The channels of the other class sharing its spectrum are busy as well.
+    for(int i = 0; i < CHANNEL_DATA_COUNT; i++)
+        if(overlap(channel, data_channels[i]) && busy[i] < 255)
+            busy[i]++;
+}
@@ -20,11 +20,12 @@
 #include "waded_usb.h"
 #include "client_cmd.h"
 #include "string_handler.h"
+#include "airtime.h"
 
 uint16_t       host_id    = 0xFFFF;
 static uint8_t usb_active = 0;
 
-#define N_CMD 9
+#define N_CMD 18
 
 /* WARNING: The command at position i must have the ID i+1 */
 static char *cmd_list[] = {
@@ -36,7 +37,16 @@ static char *cmd_list[] = {
     REC_TXT_CMD,
     GET_ID_CMD,
     MY_ID_CMD,
-    SET_DATE_CMD
+    SET_DATE_CMD,
+    SET_HOP_CMD,
+    SET_ROLE_CMD,
+    SET_QUOTA_CMD,
+    GET_POWER_CMD,
+    POWER_CMD,
+    GET_ROLE_CMD,
+    ROLE_CMD,
+    GET_AIRTIME_CMD,
+    AIRTIME_CMD
 };
 
 //USE_MEMORY
@@ -177,6 +187,46 @@ static uint16_t set_id_from_str(char *str, struct Bucket *buc)
     return 0;
 }
 
+static uint16_t set_hop_from_str(char *str, struct Bucket *buc)
+{
+    str = skip_spaces(str);
+    if(!is_num(*str))
+            return 1;
+    uint16_t hops = str_to_int(str, &str);
+    if(hops > HOP_UNLIMITED)
+            return 1;
+    buc->hop_limit = hops;
+
+    return 0;
+}
+
+static uint16_t set_role_from_str(char *str, struct Bucket *buc)
+{
+    str = skip_spaces(str);
+    if(!is_num(*str))
+            return 1;
+    uint16_t role = str_to_int(str, &str);
+    if(role > 1)
+            return 1;
+    buc->type_id = role;
+
+    return 0;
+}
+
+static uint16_t set_quota_from_str(char *str, struct Bucket *buc)
+{
+    str = skip_spaces(str);
+    if(!is_num(*str))
+            return 1;
+    buc->source_address = str_to_int(str, &str);
+    str = skip_spaces(str);
+    if(!is_num(*str))
+            return 1;
+    buc->destination_address = str_to_int(str, &str);
+
+    return 0;
+}
+
 static char* my_id_to_str(char *str, uint16_t id)
 {
     uint16_t i;
@@ -192,6 +242,47 @@ static char* my_id_to_str(char *str, uint16_t id)
     return str;
 }
 
+static char* power_to_str(char *str, const struct PowerStats *stats)
+{
+    str += string_copy(str, POWER_CMD, 0);
+    *(str++) = ' ';
+    str = int_to_str(str, stats->run / CH_FREQUENCY);
+    *(str++) = ' ';
+    str = int_to_str(str, stats->sleep / CH_FREQUENCY);
+    *(str++) = ' ';
+    str = int_to_str(str, stats->stop / CH_FREQUENCY);
+    *(str++) = ' ';
+    str = int_to_str(str, stats->stops);
+    *(str++) = ' ';
+    str = int_to_str(str, stats->fram.asleep / CH_FREQUENCY);
+    *(str++) = ' ';
+    str = int_to_str(str, stats->fram.wakeups);
+    str = insert_linefeed(str);
+    return str;
+}
+
+static char* role_to_str(char *str, uint8_t role)
+{
+    str += string_copy(str, ROLE_CMD, 0);
+    *(str++) = ' ';
+    str = int_to_str(str, role);
+    str = insert_linefeed(str);
+    return str;
+}
+
+static char* airtime_to_str(char *str)
+{
+    str += string_copy(str, AIRTIME_CMD, 0);
+    *(str++) = ' ';
+    str = int_to_str(str, airtime_total() / 1000);
+    for (int f = 0; f < AIRTIME_FREQUENCIES; f++) {
+        *(str++) = ' ';
+        str = int_to_str(str, airtime_used(f) / 1000);
+    }
+    str = insert_linefeed(str);
+    return str;
+}
+
 static char* ack_to_str(char *str)
 {
     uint16_t i;
@@ -299,6 +390,33 @@ uint16_t get_command(struct Bucket * buc)
             return 0;
         case GET_ID_ID:
             return GET_ID_ID;
+        case GET_POWER_ID:
+            return GET_POWER_ID;
+        case GET_ROLE_ID:
+            return GET_ROLE_ID;
+        case GET_AIRTIME_ID:
+            return GET_AIRTIME_ID;
+        case SET_HOP_ID:
+            if (set_hop_from_str(content, buc)) {
+                send_nack(cmd_buf, "bad command");
+                return 0;
+            }
+            send_ack(cmd_buf);
+            return SET_HOP_ID;
+        case SET_ROLE_ID:
+            if (set_role_from_str(content, buc)) {
+                send_nack(cmd_buf, "bad command");
+                return 0;
+            }
+            send_ack(cmd_buf);
+            return SET_ROLE_ID;
+        case SET_QUOTA_ID:
+            if (set_quota_from_str(content, buc)) {
+                send_nack(cmd_buf, "bad command");
+                return 0;
+            }
+            send_ack(cmd_buf);
+            return SET_QUOTA_ID;
         case SET_DATE_ID:
             if (!set_date_from_str(content, buc))
                 send_nack(cmd_buf, "bad command");
@@ -317,12 +435,31 @@ void send_usr_id(uint16_t id)
     usb_puts(cmd_buf);
 }
 
-void send_usr_message(const struct Bucket *buc)
+void send_usr_power(const struct PowerStats *stats)
+{
+    power_to_str(cmd_buf, stats);
+    usb_puts(cmd_buf);
+}
+
+void send_usr_role(uint8_t role)
+{
+    role_to_str(cmd_buf, role);
+    usb_puts(cmd_buf);
+}
+
+void send_usr_airtime(void)
+{
+    airtime_to_str(cmd_buf);
+    usb_puts(cmd_buf);
+}
+
+int send_usr_message(const struct Bucket *buc)
 {
     if (!usb_active || buc->destination_address != host_id)
-        return;
+        return 0;
     bucket_to_str(cmd_buf, buc);
     usb_puts(cmd_buf);
+    return 1;
 }
 
 void activate_usb(void)
@@ -35,7 +35,7 @@
 static const uint32_t center_frequencies[] = {
     FREQ(433.164), FREQ(433.272), FREQ(433.380), FREQ(433.488),
     FREQ(433.596), FREQ(433.704), FREQ(433.812), FREQ(433.920),
-    FREQ(434.028), FREQ(434.136), FREQ(433.244), FREQ(434.352),
+    FREQ(434.028), FREQ(434.136), FREQ(434.244), FREQ(434.352),
     FREQ(434.460), FREQ(434.568), FREQ(434.676)
 };
 
@@ -59,8 +59,8 @@ static const uint32_t bandwidth[] = {
  * - Select the frequency deviation: 0.50MHz.
  * - Select the Channel, (hi-rate channel by default).
  * - Select 50 ohms impedance for the out circuit. And use the maximum gain.
- * - Select the channel filter and DC cancellation parameters -
- *   83kHz & 206Hz (0.25%).
+ * - Select the channel filter and DC cancellation parameters with the
+ *   channel - 83kHz or 200kHz & 0.25%.
  * - Set the preamble to 4 bytes.
  * - Synchronisation word is set to two bytes.
  * - The packet mode is set by default to foreground packet.
@@ -72,37 +72,33 @@ static const uint32_t bandwidth[] = {
  */
 void dash7_init(void)
 {
-    sx_write8(REG_DATA_MODUL, DATA_MODE(PACKET_MODE) | MODULATION_TYPE(FSK) |
-              MODULATION_SHAPING(FILTER_1));
-
-    sx_write16(REG_FDEV_MSB, FREQ(0.050));
+    // By increasing address, so that the registers following each other are
+    // written in a single burst.
+    static const struct SxRegister init_table[] = {
+        {REG_DATA_MODUL,      DATA_MODE(PACKET_MODE) | MODULATION_TYPE(FSK) |
+                              MODULATION_SHAPING(FILTER_1)},
+        {REG_FDEV_MSB,        FREQ(0.050) >> 8},
+        {REG_FDEV_LSB,        FREQ(0.050) & 0xFF},
+        {REG_LNA,             LNA_ZIN(0) | LNA_GAIN_SELECT(GAIN_0)},
+        {REG_RSSI_THRESH,     VALUE_RSSI_THRESH},
+        {REG_PREAMBLE_MSB,    0},
+        {REG_PREAMBLE_LSB,    4},
+        {REG_SYNC_CONFIG,     SYNC_ON(ON) | SYNC_SIZE(1)},  // 1+1 = 2
+        {REG_SYNC_VALUE_1,    FOREGROUND_MODE >> 8},
+        {REG_SYNC_VALUE_2,    FOREGROUND_MODE & 0xFF},
+        // The coded channels do the whitening in software, see select_coding
+        {REG_PACKET_CONFIG_1, PACKET_FORMAT(VARIABLE_LENGTH) |
+                              DC_FREE(DC_WHITENING) | CRC_ON(ON) |
+                              CRC_AUTO_CLEAR_OFF(ON) |
+                              ADDRESS_FILTERING(ADDR_FILT_NONE)},
+        {REG_PAYLOAD_LENGTH,  255},
+        {REG_FIFO_THRESH,     TX_START_CONDITION(TX_CONDITION_FIFO_NOT_EMPTY) |
+                              FIFO_THRESHOLD(VALUE_FIFO_THRESH)},
+    };
+
+    sx_configure(init_table, sizeof init_table / sizeof init_table[0]);
 
     select_channel(HI_RATE_CHANNEL);
-
-    sx_write8(REG_LNA, LNA_ZIN(0) | LNA_GAIN_SELECT(GAIN_0));
-
-    // TODO: check if the default value (4%) is better or worse
-    sx_write8(REG_RX_BW, RX_BW_MANT(MANT_24) | RX_BW_EXP(2) | DCC_FREQ(6));
-
-    sx_write16(REG_PREAMBLE_MSB, 4);
-
-    sx_write8(REG_SYNC_CONFIG, SYNC_ON(ON) | SYNC_SIZE(1));  // 1+1 = 2
-
-    select_packet_mode(FOREGROUND_MODE);
-
-    // TODO: the whitening may have to be done in software if we want to
-    // use FEC
-    sx_write8(REG_PACKET_CONFIG_1, PACKET_FORMAT(VARIABLE_LENGTH) |
-              DC_FREE(DC_WHITENING) | CRC_ON(ON) | CRC_AUTO_CLEAR_OFF(ON) |
-              ADDRESS_FILTERING(ADDR_FILT_NONE));
-
-    sx_write8(REG_PAYLOAD_LENGTH, 255);
-
-    sx_write8(REG_FIFO_THRESH,
-              TX_START_CONDITION(TX_CONDITION_FIFO_NOT_EMPTY) |
-              FIFO_THRESHOLD(VALUE_FIFO_THRESH));
-
-    set_rssi_thresh(VALUE_RSSI_THRESH);
 }
 
 /**
@@ -112,12 +108,38 @@ void dash7_init(void)
  */
 void select_channel(uint8_t channel)
 {
+    // Nothing is written if the channel does not change.
     // Select the base frequency
     sx_write24(REG_FRF_MSB, center_frequencies[channel & 0xf]);
 
-    // Select the symbol rate (FSK 1.8 or FSK 0.5)
-    uint8_t bandwidth_index = (channel >> 8) & 0x7;
-    sx_write16(REG_BITRATE_MSB, SYMRATE(bandwidth_index <= 2 ? 55.555 : 200));
+    // Select the symbol rate (FSK 1.8 or FSK 0.5) from the channel class,
+    // and the channel filter letting it through: 83kHz or 200kHz.
+    // TODO: check if the default DCC value (4%) is better or worse than 0.25%
+    uint8_t bandwidth_index = (channel >> 4) & 0x7;
+    if (bandwidth_index <= 2) {
+        sx_write16(REG_BITRATE_MSB, SYMRATE(55.555));
+        sx_write8(REG_RX_BW, RX_BW_MANT(MANT_24) | RX_BW_EXP(2) | DCC_FREQ(6));
+    } else {
+        sx_write16(REG_BITRATE_MSB, SYMRATE(200));
+        sx_write8(REG_RX_BW, RX_BW_MANT(MANT_20) | RX_BW_EXP(1) | DCC_FREQ(6));
+    }
+}
+
+/**
+ * @brief Select who checks and whitens the packets.
+ *
+ * @param software 0 for the SX1231, 1 for the software, see fec.h.
+ */
+void select_coding(int software)
+{
+    if (software)
+        sx_write8(REG_PACKET_CONFIG_1, PACKET_FORMAT(VARIABLE_LENGTH) |
+                  DC_FREE(DC_NONE) | CRC_ON(OFF) |
+                  ADDRESS_FILTERING(ADDR_FILT_NONE));
+    else
+        sx_write8(REG_PACKET_CONFIG_1, PACKET_FORMAT(VARIABLE_LENGTH) |
+                  DC_FREE(DC_WHITENING) | CRC_ON(ON) |
+                  CRC_AUTO_CLEAR_OFF(ON) | ADDRESS_FILTERING(ADDR_FILT_NONE));
 }
 
 /**
@@ -26,6 +26,7 @@
 #include "hal.h"
 #include "dio.h"
 #include "dash7.h"
+#include "standby_mode.h"
 
 static EVENTSOURCE_DECL(dio0_event);
 static EVENTSOURCE_DECL(dio1_event);
@@ -89,6 +90,16 @@ static const EXTConfig extcfg = {
         {EXT_CH_MODE_DISABLED, NULL},
         // 15: Nothing
         {EXT_CH_MODE_DISABLED, NULL},
+        // 16: PVD
+        {EXT_CH_MODE_DISABLED, NULL},
+        // 17: RTC alarm
+        {EXT_CH_MODE_DISABLED, NULL},
+        // 18: USB wakeup
+        {EXT_CH_MODE_DISABLED, NULL},
+        // 19: RTC tamper and timestamp
+        {EXT_CH_MODE_DISABLED, NULL},
+        // 20: RTC wakeup timer, counts the time spent in stop
+        {EXT_CH_MODE_RISING_EDGE | EXT_CH_MODE_AUTOSTART, stop_wakeup_cb},
     }
 };
 
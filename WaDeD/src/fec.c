@@ -0,0 +1,270 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  fec.c
+ * @brief Forward error correction and whitening of the radio packets.
+ *
+ * The Reed-Solomon code works on GF(256), generated by x^8 + x^4 + x^3 + x^2
+ * + 1, with the roots alpha^0 to alpha^(FEC_PARITY - 1) and alpha = 2. The
+ * products are computed without tables, which would cost more RAM than the
+ * few thousand multiplications per packet cost time.
+ */
+
+#include "fec.h"
+
+#define unless(x) if(!(x))
+
+/**
+ * @brief Coefficients of the generator polynomial, x^0 first, without the
+ * x^FEC_PARITY one.
+ */
+static const uint8_t generator [FEC_PARITY] = {
+    0x3B, 0x24, 0x32, 0x62, 0xE5, 0x29, 0x41, 0xA3,
+    0x08, 0x1E, 0xD1, 0x44, 0xBD, 0x68, 0x0D, 0x3B
+};
+
+/**
+ * @brief The packet being coded.
+ */
+static struct {
+    size_t    size;
+    tx_fill_t fill;
+    uint16_t  crc;
+    uint16_t  pn9;
+    uint8_t   parity[FEC_PARITY];
+} tx;
+
+static uint8_t gf_mul(uint8_t a, uint8_t b)
+{
+    uint8_t p = 0;
+    while(b) {
+        if(b & 1)
+            p ^= a;
+        a = (a << 1) ^ ((a & 0x80) ? 0x1D : 0);
+        b >>= 1;
+    }
+    return p;
+}
+
+static uint8_t gf_inv(uint8_t a)
+{
+    // a^254 = a^-1, since a^255 = 1.
+    uint8_t r = 1;
+    for(int i = 0; i < 7; i++) {
+        a = gf_mul(a, a);
+        r = gf_mul(r, a);
+    }
+    return r;
+}
+
+/**
+ * @brief Evaluate a polynomial, x^0 first.
+ */
+static uint8_t gf_eval(const uint8_t *poly, int degree, uint8_t x)
+{
+    uint8_t r = 0;
+    for(int i = degree; i >= 0; i--)
+        r = gf_mul(r, x) ^ poly[i];
+    return r;
+}
+
+static uint16_t crc_update(uint16_t crc, uint8_t b)
+{
+    crc ^= (uint16_t) b << 8;
+    for(int i = 0; i < 8; i++)
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    return crc;
+}
+
+/**
+ * @brief Get the next byte of the PN9 sequence.
+ */
+static uint8_t pn9_next(uint16_t *pn9)
+{
+    uint8_t b = *pn9 & 0xFF;
+    for(int i = 0; i < 8; i++)
+        *pn9 = (*pn9 >> 1) | (((*pn9 ^ (*pn9 >> 5)) & 1) << 8);
+    return b;
+}
+
+static void rs_update(uint8_t *parity, uint8_t b)
+{
+    uint8_t feedback = b ^ parity[0];
+    for(int i = 0; i < FEC_PARITY - 1; i++)
+        parity[i] = parity[i + 1]
+                  ^ gf_mul(feedback, generator[FEC_PARITY - 1 - i]);
+    parity[FEC_PARITY - 1] = gf_mul(feedback, generator[0]);
+}
+
+size_t fec_start(size_t size, tx_fill_t fill)
+{
+    tx.size = size;
+    tx.fill = fill;
+    tx.crc  = 0xFFFF;
+    tx.pn9  = 0x1FF;
+    for(int i = 0; i < FEC_PARITY; i++)
+        tx.parity[i] = 0;
+    return size + FEC_OVERHEAD;
+}
+
+void fec_fill(void *chunk, size_t offset, size_t size)
+{
+    uint8_t *b = chunk;
+
+    // The bytes of the packet itself.
+    if(offset < tx.size) {
+        size_t n = tx.size - offset < size ? tx.size - offset : size;
+        tx.fill(b, offset, n);
+        for(size_t i = 0; i < n; i++) {
+            tx.crc = crc_update(tx.crc, b[i]);
+            rs_update(tx.parity, b[i]);
+        }
+    }
+
+    for(size_t i = 0; i < size; i++, offset++) {
+        if(offset == tx.size) {
+            // The parity covers the CRC too.
+            rs_update(tx.parity, tx.crc >> 8);
+            rs_update(tx.parity, tx.crc & 0xFF);
+        }
+        if(offset == tx.size)
+            b[i] = tx.crc >> 8;
+        else if(offset == tx.size + 1)
+            b[i] = tx.crc & 0xFF;
+        else if(offset > tx.size + 1)
+            b[i] = tx.parity[offset - tx.size - 2];
+        b[i] ^= pn9_next(&tx.pn9);
+    }
+}
+
+void fec_whiten(void *buf, size_t size)
+{
+    uint16_t pn9 = 0x1FF;
+    for(size_t i = 0; i < size; i++)
+        ((uint8_t *) buf)[i] ^= pn9_next(&pn9);
+}
+
+/**
+ * @brief Correct the errors of a codeword, first byte of highest degree.
+ *
+ * @param r The codeword.
+ * @param n Its size, at most 255.
+ *
+ * @return 1 if it is correct now, 0 if it has too many errors.
+ */
+static int rs_correct(uint8_t *r, int n)
+{
+    uint8_t s [FEC_PARITY];
+    int errors = 0;
+
+    // Syndromes: the codeword evaluated at the roots of the generator.
+    uint8_t root = 1;
+    for(int i = 0; i < FEC_PARITY; i++) {
+        s[i] = 0;
+        for(int j = 0; j < n; j++)
+            s[i] = gf_mul(s[i], root) ^ r[j];
+        if(s[i])
+            errors = 1;
+        root = gf_mul(root, 2);
+    }
+    unless(errors)
+        return 1;
+
+    // Berlekamp-Massey: the error locator lambda.
+    uint8_t lambda [FEC_PARITY + 1] = {1};
+    uint8_t prev [FEC_PARITY + 1]   = {1};
+    uint8_t prev_d = 1;
+    int     l      = 0;
+    int     m      = 1;
+    for(int k = 0; k < FEC_PARITY; k++, m++) {
+        uint8_t d = s[k];
+        for(int i = 1; i <= l; i++)
+            d ^= gf_mul(lambda[i], s[k - i]);
+        unless(d)
+            continue;
+
+        uint8_t coef = gf_mul(d, gf_inv(prev_d));
+        uint8_t saved [FEC_PARITY + 1];
+        for(int i = 0; i <= FEC_PARITY; i++)
+            saved[i] = lambda[i];
+        for(int i = 0; i + m <= FEC_PARITY; i++)
+            lambda[i + m] ^= gf_mul(coef, prev[i]);
+        if(2 * l <= k) {
+            l = k + 1 - l;
+            for(int i = 0; i <= FEC_PARITY; i++)
+                prev[i] = saved[i];
+            prev_d = d;
+            m = 0;
+        }
+    }
+    if(l > FEC_PARITY / 2)
+        return 0;
+
+    // The error evaluator omega = s * lambda mod x^FEC_PARITY.
+    uint8_t omega [FEC_PARITY];
+    for(int i = 0; i < FEC_PARITY; i++) {
+        omega[i] = 0;
+        for(int k = 0; k <= i && k <= l; k++)
+            omega[i] ^= gf_mul(s[i - k], lambda[k]);
+    }
+
+    // The formal derivative of lambda: its odd terms, shifted.
+    uint8_t derivative [FEC_PARITY];
+    for(int i = 0; i < FEC_PARITY; i++)
+        derivative[i] = (i & 1) ? 0 : lambda[i + 1];
+
+    // Chien search: the byte j is wrong if lambda(alpha^-(n-1-j)) = 0, and
+    // Forney gives its error.
+    uint8_t x_inv = 1; // alpha^-(n-1-j)
+    for(int j = 0; j < 255 - (n - 1); j++)
+        x_inv = gf_mul(x_inv, 2);
+    int found = 0;
+    for(int j = 0; j < n; j++, x_inv = gf_mul(x_inv, 2)) {
+        if(gf_eval(lambda, l, x_inv))
+            continue;
+        uint8_t den = gf_eval(derivative, FEC_PARITY - 1, x_inv);
+        unless(den)
+            return 0;
+        r[j] ^= gf_mul(gf_inv(x_inv),
+                       gf_mul(gf_eval(omega, FEC_PARITY - 1, x_inv),
+                              gf_inv(den)));
+        found++;
+    }
+    return found == l;
+}
+
+int fec_decode(void *buf, size_t size)
+{
+    uint8_t *b = buf;
+    if(size < FEC_OVERHEAD || size > 255)
+        return RECEIVE_CRC_ERROR;
+
+    fec_whiten(b, size);
+    unless(rs_correct(b, size))
+        return RECEIVE_CRC_ERROR;
+
+    size -= FEC_OVERHEAD;
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < size; i++)
+        crc = crc_update(crc, b[i]);
+    unless(b[size] == crc >> 8 && b[size + 1] == (crc & 0xFF))
+        return RECEIVE_CRC_ERROR;
+    return size;
+}
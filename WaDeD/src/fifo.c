@@ -22,12 +22,18 @@
  * @brief Handle a fifo to determine to future messages to send.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include "fifo.h"
 #include "tree.h"
 #include "jungle.h"
+#include "session.h"
+#include "route.h"
+#include "role.h"
+#include "neighbour.h"
+#include "receipt.h"
+#include "airtime.h"
 
-static const int PROTOCOL_VERSION = 0;
 extern int DEVICE_ID;
 #ifndef __TAG_MODE__
 #define FIRST_BYTE PROTOCOL_VERSION
@@ -43,11 +49,24 @@ extern int DEVICE_ID;
  */
 static uint16_t  fifo [FIFO_MAXSIZE];
 
-uint8_t  tx_buffer[164];
+uint8_t  tx_buffer[PACKET_MAX_SIZE];
 static int       fifo_head     = 0; /**< Fifo head. */
 static int       fifo_tail     = 0; /**< Fifo tail. */
 static int       fifo_size     = 0; /**< Fifo size. */
-static systime_t fifo_deadline = 0; /**< Deadline to a new ROOT message. */
+static systime_t root_start    = 0; /**< Start of the current ROOT period. */
+static systime_t root_time     = 0; /**< When to send the ROOT in the period. */
+static systime_t root_interval = 0; /**< Period length. */
+static int       root_sent     = 0; /**< ROOT already handled this period. */
+static int       root_heard    = 0; /**< Identical ROOTs heard this period. */
+
+#define NO_STREAM 0xFFFF
+
+/**
+ * @brief Stored message whose text ends the packet in tx_buffer, read from
+ * FRAM as the packet is sent.
+ */
+static uint16_t  stream_address = NO_STREAM;
+static uint8_t   stream_start   = 0; /**< Offset of the text in the packet. */
 
 #else
 extern uint8_t  *tx_buffer;
@@ -57,6 +76,13 @@ extern int       fifo_tail;
 extern int       fifo_size;
 #endif // __SIMU__
 
+void fifo_put_header(uint8_t type, uint8_t length)
+{
+    tx_buffer[0] = (FIRST_BYTE << 4) | type;
+    tx_buffer[1] = length;
+    *((uint16_t *) (tx_buffer + 2)) = node_address;
+}
+
 /**
  * @brief Prepare a packet, ready to be sent, containing a node and its sons.
  *
@@ -70,20 +96,19 @@ extern int       fifo_size;
  * bytes 1-8: node hash
  * bytes 9-72: sons hashes, in order from left to right
  *
- * The packet header should be 00000000, followed by an octet indicating the
- * size of the packet, which is 73.
+ * The packet header carries the type NODE and a length of 73.
  */
 static void prepare_node(uint8_t n)
 {
-    tx_buffer[0] = (FIRST_BYTE << 4) | NODE;
-    tx_buffer[1] = 73;
-    tx_buffer[2] = n;
+    uint8_t *body = tx_buffer + HEADER_SIZE;
+    fifo_put_header(NODE, 73);
+    body[0] = n;
 
     uint64_t *hash, *son_hashes;
     get_hash_and_sons(n, &hash, &son_hashes);
-    memcpy(tx_buffer + 3, hash, 8);
+    memcpy(body + 1, hash, 8);
     for (int i = 0; i < 8; i ++)
-        memcpy(tx_buffer + 11 + 8*i, son_hashes + i, 8);
+        memcpy(body + 9 + 8*i, son_hashes + i, 8);
 }
 
 /**
@@ -96,18 +121,18 @@ static void prepare_node(uint8_t n)
  * bytes 2-9: list hash
  * bytes 10+: hashes of each element in the list
  *
- * The packet header should be 00000001, followed by an octet indicating the
- * packet size, which is 10 + 8 * (number of elements in the list).
+ * The packet header carries the type LEAF and a length of
+ * 10 + 8 * (number of elements in the list).
  */
 static void prepare_leaf(uint16_t l)
 {
-    tx_buffer[0] = (FIRST_BYTE << 4) | LEAF;
+    uint8_t *body = tx_buffer + HEADER_SIZE;
 
     uint64_t hash = get_leaf_hash(l);
-    memcpy(tx_buffer + 4, &hash, 8);
-    int length = get_list(l, (uint64_t *) (tx_buffer + 12));
-    *((uint16_t *) (tx_buffer + 2)) = (l << 6) | length;
-    tx_buffer[1] = 10 + 8 * length;
+    memcpy(body + 2, &hash, 8);
+    int length = get_list(l, body + 10);
+    *((uint16_t *) body) = (l << 6) | length;
+    fifo_put_header(LEAF, 10 + 8 * length);
 
     // TODO maybe do something in the rare case of a long list (> 18 elements)
 }
@@ -119,14 +144,20 @@ static void prepare_leaf(uint16_t l)
  * bytes 0-7: top hash of the left tree.
  * bytes 8-15: top hash of the right tree.
  *
- * The packet header should be 00000002, followed by an octet indicating the
- * packet size, which is always 16.
+ * Under __ROUTING__, our route filter follows:
+ * bytes 16-31: filter of the addresses reachable through us.
+ *
+ * The packet header carries the type ROOT and a length of 16, or 32.
  */
 static void prepare_roots(void)
 {
-    tx_buffer[0] = (FIRST_BYTE << 4) | ROOT;
-    tx_buffer[1] = 16;
-    tree_get_roots(&tx_buffer[2]);
+    tree_get_roots(tx_buffer + HEADER_SIZE);
+#ifdef __ROUTING__
+    route_get_filter(tx_buffer + HEADER_SIZE + 16);
+    fifo_put_header(ROOT, 16 + ROUTE_FILTER_SIZE);
+#else
+    fifo_put_header(ROOT, 16);
+#endif // __ROUTING__
 }
 
 /**
@@ -140,31 +171,89 @@ static void prepare_roots(void)
  * bytes 12-15: expiration date
  * bytes 16-17: source address
  * bytes 18-19: destination address
- * bytes 20+: content of the message, up to 140 characters
+ * byte 20: hop limit, the number of relays left or HOP_UNLIMITED
+ * bytes 21+: content of the message, up to 140 characters
  *
- * The packet header should be 00000003 (protocol version, packet identifier),
- * followed by an octet indicating the length of the packet, stripped of the
- * header(for an empty message, that would be 20).
+ * The packet header carries the type MESSAGE and the length of the packet,
+ * stripped of the header (for an empty message, that would be 21).
  */
 static void prepare_message(uint16_t address)
 {
-    tx_buffer[0] = (FIRST_BYTE << 4) | MESSAGE;
+    fifo_put_header(MESSAGE,
+                    fifo_put_message(tx_buffer + HEADER_SIZE, address));
+}
+
+uint8_t fifo_put_message(uint8_t *body, uint16_t address)
+{
+#ifndef __SIMU__
+    // The fields sent lie at the head of the bucket, in the order of the
+    // packet: read them at once, and leave the text in FRAM.
+    uint8_t head [offsetof(struct Bucket, message)];
+    fram_read(BUCKETS_START + BUCKET_SIZE * address, head, sizeof head);
+    memcpy(body, head, offsetof(struct Bucket, destination_address) + 2);
+    body[20] = head[offsetof(struct Bucket, hop_limit)];
+
+    uint8_t length = head[offsetof(struct Bucket, length)];
+    if (length > MESSAGE_MAX_SIZE - MESSAGE_HEADER_SIZE)
+        length = MESSAGE_MAX_SIZE - MESSAGE_HEADER_SIZE;
 
+    stream_address = address;
+    stream_start   = body + MESSAGE_HEADER_SIZE - tx_buffer;
+    return MESSAGE_HEADER_SIZE + length;
+#else
     struct Bucket bucket;
     read_bucket(address, &bucket);
-    memcpy(tx_buffer +  2, &bucket.type.id, 8);
-    *((uint32_t *) (tx_buffer + 10)) = bucket.emission_date;
-    *((uint32_t *) (tx_buffer + 14)) = bucket.expiration_date;
-    *((uint16_t *) (tx_buffer + 18)) = bucket.source_address;
-    *((uint16_t *) (tx_buffer + 20)) = bucket.destination_address;
+    memcpy(body, &bucket.type.id, 8);
+    *((uint32_t *) (body +  8)) = bucket.emission_date;
+    *((uint32_t *) (body + 12)) = bucket.expiration_date;
+    *((uint16_t *) (body + 16)) = bucket.source_address;
+    *((uint16_t *) (body + 18)) = bucket.destination_address;
+    body[20] = bucket.hop_limit;
     int i = 0;
     while (bucket.message[i]) {
-        tx_buffer[22 + i] = bucket.message[i];
+        body[MESSAGE_HEADER_SIZE + i] = bucket.message[i];
         i++;
     }
-    tx_buffer[1] = 20 + i;
+    return MESSAGE_HEADER_SIZE + i;
+#endif // __SIMU__
 }
 
+#ifndef __SIMU__
+/**
+ * @brief Get the address in FRAM of a byte of the streamed text.
+ *
+ * @param offset The offset of the byte in the packet.
+ *
+ * @return Its address in FRAM.
+ */
+static inline uint32_t stream_fram_address(size_t offset)
+{
+    return BUCKETS_START + BUCKET_SIZE * stream_address
+        + offsetof(struct Bucket, message) + offset - stream_start;
+}
+
+void fifo_tx_fill(void *chunk, size_t offset, size_t size)
+{
+    uint8_t *c = chunk;
+    while (size && (stream_address == NO_STREAM || offset < stream_start)) {
+        *(c++) = tx_buffer[offset++];
+        size--;
+    }
+    if (size)
+        fram_read(stream_fram_address(offset), c, size);
+}
+
+/**
+ * @brief Copy the streamed text in tx_buffer, before its bucket is erased.
+ */
+static void stream_detach(void)
+{
+    fram_read(stream_fram_address(stream_start), tx_buffer + stream_start,
+              tx_buffer[1] + HEADER_SIZE - stream_start);
+    stream_address = NO_STREAM;
+}
+#endif // __SIMU__
+
 /**
  * @brief Remove the first element of the fifo. Do not use if fifo is empty.
  */
@@ -191,6 +280,21 @@ static inline void push(uint16_t i)
     fifo_size++;
 }
 
+/**
+ * @brief Remove the element at a given place of the fifo.
+ *
+ * @param j The place of the element, counted from the head.
+ */
+static void remove_at(int j)
+{
+    for (; j < fifo_size - 1; j++)
+        fifo[(fifo_head + j) % FIFO_MAXSIZE] =
+            fifo[(fifo_head + j + 1) % FIFO_MAXSIZE];
+
+    fifo_tail = (fifo_tail ? (fifo_tail - 1) : (FIFO_MAXSIZE - 1));
+    fifo_size--;
+}
+
 /**
  * @brief Determine if an element is in the fifo.
  *
@@ -206,25 +310,117 @@ static int fifo_has(uint16_t i)
     return 0;
 }
 
+#ifndef __SIMU__
+/**
+ * @brief Start a new ROOT period, at the current interval.
+ *
+ * @param now The current system time.
+ */
+static void new_period(systime_t now)
+{
+    root_start = now;
+    root_time  = root_interval / 2 + rand() % (root_interval / 2 + 1);
+    root_sent  = 0;
+    root_heard = 0;
+}
+
+/**
+ * @brief Prepare our ROOT if it is due.
+ *
+ * This follows the trickle algorithm: once per period, at a random time in its
+ * second half, the ROOT is sent unless ROOT_REDUNDANCY identical ones were
+ * heard before. Each time a period ends, the next one is twice as long, up to
+ * the maximum of our role, unless a neighbour we hear has not caught up with
+ * us yet. fifo_root_reset() brings it back to the minimum.
+ *
+ * @return 1 if the ROOT has been put in tx_buffer, 0 if not.
+ */
+static int root_due(void)
+{
+    systime_t now = chTimeNow();
+
+    // The network stayed consistent during the whole period: slow down, once
+    // the neighbours behind us have caught up.
+    if ((systime_t) (now - root_start) >= root_interval) {
+        const struct Role *r = role_profile();
+        if (neighbour_all_synced())
+            root_interval *= 2;
+        if (root_interval < r->root_interval_min)
+            root_interval = r->root_interval_min;
+        if (root_interval > r->root_interval_max)
+            root_interval = r->root_interval_max;
+        new_period(now);
+    }
+
+    if (root_sent || (systime_t) (now - root_start) < root_time)
+        return 0;
+
+    // Maybe later in the period, once some airtime is back.
+    unless(airtime_allows(ROOT))
+        return 0;
+    root_sent = 1;
+
+    // Enough neighbours already advertised our roots during this period, ours
+    // would only be a duplicate.
+    if (root_heard >= ROOT_REDUNDANCY)
+        return 0;
+
+    prepare_roots();
+    return 1;
+}
+
+/**
+ * @brief Find the next element of the fifo which the airtime left allows to
+ * send, so that it goes to the most valuable ones.
+ *
+ * @return Its place, counted from the head, or -1 if there is none.
+ */
+static int pick(void)
+{
+    for (int k = 0; k < fifo_size; k++) {
+#ifndef __LIFO__
+        int j = k;
+#else
+        int j = fifo_size - 1 - k;
+#endif // __LIFO__
+        if (airtime_allows(fifo[(fifo_head + j) % FIFO_MAXSIZE] >> 12))
+            return j;
+    }
+    return -1;
+}
+#endif // __SIMU__
+
 /**
  * @brief Prepare the next message to be sent.
  */
 int fifo_pop(void)
 {
-    unless(fifo_size) {
 #ifndef __SIMU__
-        if ((int32_t) (fifo_deadline + S2ST(2) - chTimeNow()) < 0) {
-            fifo_deadline = chTimeNow();
+    stream_address = NO_STREAM;
+
+    // Sessions carry the bulk of the transfers, serve them first.
+    if (airtime_allows(DATA) && session_pop())
+        return 1;
 #endif // __SIMU__
-            prepare_roots();
-            return 1;
+
+    unless(fifo_size) {
 #ifndef __SIMU__
-        } else
-            return 0;
+        return root_due();
+#else
+        prepare_roots();
+        return 1;
 #endif // __SIMU__
     }
 
-#ifndef __LIFO__
+#ifndef __SIMU__
+    int j = pick();
+    if (j < 0)
+        return 0;
+    uint16_t i = fifo[(fifo_head + j) % FIFO_MAXSIZE];
+    remove_at(j);
+    uint8_t type = (uint8_t) (i >> 12);
+    uint16_t arg = i & 0x0FFF;
+#elif !defined(__LIFO__)
     uint8_t type = (uint8_t) (fifo[fifo_head] >> 12);
     uint16_t arg = fifo[fifo_head] & 0x0FFF;
     pop();
@@ -232,7 +428,7 @@ int fifo_pop(void)
     uint8_t type = (uint8_t) (fifo[fifo_tail] >> 12);
     uint16_t arg = fifo[fifo_tail] & 0x0FFF;
     pop();
-#endif // __LIFO__
+#endif // __SIMU__
 
     switch (type) {
         case NODE:
@@ -247,6 +443,9 @@ int fifo_pop(void)
         case MESSAGE:
             prepare_message(arg);
             break;
+        case RECEIPT:
+            fifo_put_header(RECEIPT, receipt_put(tx_buffer + HEADER_SIZE));
+            break;
     }
     return 1;
 }
@@ -273,3 +472,61 @@ void fifo_push(uint16_t arg, uint8_t type)
     unless(fifo_has(i))
         push(i);
 }
+
+void fifo_push_first(uint16_t arg, uint8_t type)
+{
+    uint16_t i = (arg & 0x0FFF) + (type << 12);
+    fifo_cancel(arg, type);
+
+#ifndef __LIFO__
+    // Drop the last one, rather than the first one as in fifo_push.
+    if(fifo_size == FIFO_MAXSIZE) {
+        fifo_tail = (fifo_tail ? (fifo_tail - 1) : (FIFO_MAXSIZE - 1));
+        fifo_size--;
+    }
+    fifo_head = (fifo_head ? (fifo_head - 1) : (FIFO_MAXSIZE - 1));
+    fifo[fifo_head] = i;
+    fifo_size++;
+#else
+    // The last pushed is the first popped.
+    if(fifo_size == FIFO_MAXSIZE) {
+        fifo_head = (fifo_head + 1) % FIFO_MAXSIZE;
+        fifo_size--;
+    }
+    push(i);
+#endif // __LIFO__
+}
+
+void fifo_cancel(uint16_t arg, uint8_t type)
+{
+#ifndef __SIMU__
+    // The message may be about to be erased, while the packet in tx_buffer,
+    // waiting for the channel, still needs its text.
+    if (type == MESSAGE && arg == stream_address)
+        stream_detach();
+#endif // __SIMU__
+
+    uint16_t i = (arg & 0x0FFF) + (type << 12);
+    for (int j = 0; j < fifo_size; j++)
+        if (fifo[(fifo_head + j) % FIFO_MAXSIZE] == i) {
+            remove_at(j);
+            return;
+        }
+}
+
+void fifo_root_heard(void)
+{
+#ifndef __SIMU__
+    root_heard++;
+#endif // __SIMU__
+}
+
+void fifo_root_reset(void)
+{
+#ifndef __SIMU__
+    if (root_interval == role_profile()->root_interval_min)
+        return;
+    root_interval = role_profile()->root_interval_min;
+    new_period(chTimeNow());
+#endif // __SIMU__
+}
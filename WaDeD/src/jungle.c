@@ -27,10 +27,40 @@
 #include "jungle.h"
 #include "tree.h"
 #include "fifo.h"
+#include "neighbour.h"
+#include "session.h"
+#include "route.h"
+#include "role.h"
+#include "receipt.h"
+#include "quota.h"
 #include "client_cmd.h"
+#include "packet.h"
 
 #define unless(x) if(!(x))
 
+// 96 bits unique ID of the STM32L.
+#define UNIQUE_ID ((const void *) 0x1FF80050)
+
+uint16_t node_address;
+
+/**
+ * @brief Held while the state of the protocol is used: the fifo, the
+ * neighbours, the sessions and the channels.
+ */
+static MUTEX_DECL(jungle_mtx);
+
+/**
+ * @brief Emission date of our last message when we were last in sync with a
+ * neighbour.
+ */
+static uint32_t since_mark = 0;
+
+/**
+ * @brief The messages to send in answer to a LEAF.
+ */
+//USE_MEMORY
+static uint16_t addresses [LIST_SEND_MAX];
+
 // #define __QUIET__
 
 /**
@@ -74,6 +104,42 @@ static void do_node(uint8_t n, uint8_t diff)
     }
 }
 
+/**
+ * @brief Queue a stored message to be broadcast.
+ *
+ * Under __ROUTING__, a message likely to reach its destination through us or
+ * our neighbours goes before the others.
+ *
+ * @param address The address of the message in FRAM.
+ */
+static void push_message(uint16_t address)
+{
+#ifdef __ROUTING__
+    if(route_reachable(BUCKET_READ_FIELD(address, destination_address, 16))) {
+        fifo_push_first(address, MESSAGE);
+        return;
+    }
+#endif // __ROUTING__
+    fifo_push(address, MESSAGE);
+}
+
+#ifdef __ROUTING__
+/**
+ * @brief Tell whether a message is likely to be delivered by us or our
+ * neighbours.
+ *
+ * @param source      The source address of the message.
+ * @param destination Its destination address.
+ *
+ * @return 1 if it is, 0 if not.
+ */
+static int reachable(uint16_t source, uint16_t destination)
+{
+    (void) source;
+    return route_reachable(destination);
+}
+#endif // __ROUTING__
+
 /**
  * @brief Handle the reception of a NODE message.
  *
@@ -87,9 +153,12 @@ static void handle_node(const void *buf)
     uint64_t *sons;
     get_hash_and_sons(n, &top, &sons);
 
-    // Compare it with the input to know if we have something to do.
-    unless(memcmp(top, ((uint8_t *) buf) + 1, 8))
+    // Compare it with the input to know if we have something to do. If the
+    // node is the same, our own NODE would only repeat it.
+    unless(memcmp(top, ((uint8_t *) buf) + 1, 8)) {
+        fifo_cancel(n, NODE);
         return;
+    }
 
     // Determine the differences in the sons' hashes.
     uint8_t diff = 0;
@@ -98,21 +167,57 @@ static void handle_node(const void *buf)
             diff |= (1 << i);
 
     // If there are some differences, we call the function that takes action.
-    if(diff)
+    if(diff) {
+        fifo_root_reset();
         do_node(n, diff);
+    }
 }
 
 /**
  * @brief Handle the reception of a ROOT message.
  *
- * @param buf The input message.
+ * @param buf    The input message.
+ * @param length Its size.
+ * @param from   The neighbour who sent it.
  */
-static void handle_root(const void *buf)
+static void handle_root(const void *buf, uint8_t length, struct Neighbour *from)
 {
+    // Keep the addresses reachable through the neighbour.
+    if(length >= 16 + ROUTE_FILTER_SIZE)
+        memcpy(from->filter, ((uint8_t *) buf) + 16, ROUTE_FILTER_SIZE);
+
     // Get our roots.
     uint8_t h [16];
     tree_get_roots(h);
 
+    unless(memcmp(h, buf, 16)) {
+        neighbour_synced(from);
+        fifo_root_heard();
+        since_mark = tree_last_emission();
+        return;
+    }
+
+    // The neighbour is already streaming its messages to us.
+    if(session_receiving(from->address))
+        return;
+
+    // Nothing changed since our last descent with this neighbour.
+    unless(neighbour_should_sync(from, buf))
+        return;
+
+    fifo_root_reset();
+
+    // We were alone for a while: what we miss is most likely what has been
+    // emitted since then, ask for it rather than going down the tree. The
+    // descent will still take place after the resync delay if needed.
+    if(from->state & NEIGHBOUR_CATCH_UP) {
+        from->state &= ~NEIGHBOUR_CATCH_UP;
+        uint32_t since = since_mark > SINCE_MARGIN ? since_mark - SINCE_MARGIN
+                                                   : 0;
+        if(session_request(from->address, since))
+            return;
+    }
+
     // Compare them, and in case of a difference, send it.
     if(memcmp(h, (uint8_t *) buf, 8))
         fifo_push((0 << 7), NODE);
@@ -125,90 +230,298 @@ static void handle_root(const void *buf)
 /**
  * @brief Handle the reception of a LIST message.
  *
- * @param buf The input message.
+ * @param buf  The input message.
+ * @param from The neighbour who sent it.
  */
-static void handle_list(const void *buf)
+static void handle_list(const void *buf, struct Neighbour *from)
 {
     // Get the information about this list in our memory.
     uint16_t leaf      = ((uint16_t *) buf)[0] >> 6;
     uint8_t  list_size = (uint8_t) (((uint16_t *) buf)[0] & 0x3F);
     uint64_t top       = get_leaf_hash(leaf);
 
-    unless(memcmp(&top, ((uint8_t *) buf) + 2, 8)) // We have the same list.
+    unless(memcmp(&top, ((uint8_t *) buf) + 2, 8)) { // We have the same list.
+        fifo_cancel(leaf, LEAF);
         return;
+    }
+
+    fifo_root_reset();
 
     // Determine how many leaves we will send.
-    uint8_t to_send = cmp_lists(leaf, ((uint8_t *) buf) + 2, list_size);
+    uint8_t to_send = cmp_lists(leaf, ((uint8_t *) buf) + 2, list_size,
+                                addresses);
 
     // If we have no leaf to send, we send our list, so the other will send the
     // difference.
     unless(to_send)
         fifo_push(leaf, LEAF);
 
+    unless(to_send)
+        return;
+
+    // If the neighbour misses many messages, stream them to it in a session
+    // rather than broadcasting them one by one.
+    from->demand = (from->demand + to_send > 255) ? 255
+                                                  : from->demand + to_send;
+    if(session_push(from->address, addresses, to_send,
+                    from->demand >= role_profile()->session_threshold))
+        return;
+
     // If we have some messages to send, send them.
     for(int i = 0; i < to_send; i++)
-        fifo_push((((uint16_t *) buf) + 1)[i], MESSAGE);
+        push_message(addresses[i]);
 }
 
 /**
  * @brief Handle the reception of a MESSAGE message.
  *
- * @param buf    The intput message.
- * @param length Its size.
+ * The bucket is built in the buffer of the packet, around the text which is
+ * left in place, over the headers once they have been parsed.
+ *
+ * @param packet The packet, holding the message after its header.
+ * @param length The size of the message, at most MESSAGE_MAX_SIZE.
  */
-void handle_message(const void *buf, uint8_t length)
+static void handle_message(struct Packet *packet, uint8_t length)
 {
-    // Build a bucket from the buffer.
-    static struct Bucket b;
-    memcpy(&b.type.id, buf, 8);
-    if(tree_has_message(b.type.id))
+    const uint8_t *buf = packet_data(packet) + HEADER_SIZE;
+    uint64_t id;
+    memcpy(&id, buf, 8);
+    uint16_t address = tree_find_message(id);
+    if(address != END_REACHED) {
+        // A neighbour just broadcast it, no need to do it again.
+        fifo_cancel(address, MESSAGE);
         return;
-    b.emission_date       = ((uint32_t *) buf)[2];
-    b.expiration_date     = ((uint32_t *) buf)[3];
-    b.source_address      = ((uint16_t *) buf)[8];
-    b.destination_address = ((uint16_t *) buf)[9];
+    }
+
+    // It has already been delivered, do not take it back.
+    if(receipt_has(id))
+        return;
+
+    uint32_t emission, expiration;
+    uint16_t source, destination;
+    memcpy(&emission,    buf +  8, 4);
+    memcpy(&expiration,  buf + 12, 4);
+    memcpy(&source,      buf + 16, 2);
+    memcpy(&destination, buf + 18, 2);
+    uint8_t hops = buf[20];
+
+    struct Bucket *b = &packet->u.bucket;
+    b->type.id             = id;
+    b->emission_date       = emission;
+    b->expiration_date     = expiration;
+    b->source_address      = source;
+    b->destination_address = destination;
+    b->state               = 0;
+
+    // A message with a limited number of hops is kept out of the trees, and
+    // only relayed by us while some hops are left.
+    if(hops == HOP_UNLIMITED) {
+        b->hop_limit = HOP_UNLIMITED;
+    } else {
+        b->hop_limit = hops ? hops - 1 : 0;
+        b->state    |= BUCKET_LOCAL;
+    }
 
     // Set unused fields at 0
-    b.hop_limit = 0;
-    b.type_id   = 0;
+    b->type_id = 0;
+
+    // The text is already in place, handle_packet bounded its length.
+    b->message[length - MESSAGE_HEADER_SIZE] = 0;
+
+#ifndef __SIMU__
+    // Send message to user. Once delivered, it does not need to be kept.
+    if(send_usr_message(b)) {
+        receipt_delivered(b->type.id, b->expiration_date);
+        return;
+    }
+#endif
 
-    // Copy message.
-    for(int i = 20; i < length; i++)
-        b.message[i - 20] = ((uint8_t *) buf)[i];
-    b.message[length - 20] = 0;
+    // Zombies only keep what concerns their host, and a few messages to
+    // relay.
+    unless(role_admit(b))
+        return;
+
+    // A source flooding the network does not push the others out.
+    unless(quota_admit(b))
+        return;
 
     // Add the message in memory.
-    tree_insert(&b);
+    address = jungle_store(b);
+#ifdef __ROUTING__
+    // Make room for a message we can deliver at the expense of one we
+    // probably cannot.
+    if(address == MEM_FULL && route_reachable(b->destination_address)) {
+        uint16_t victim = tree_evictable(reachable, ROUTE_EVICT_SCAN);
+        if(victim != END_REACHED) {
+            jungle_evict(victim);
+            address = jungle_store(b);
+        }
+    }
+#endif // __ROUTING__
+    if(b->state & BUCKET_LOCAL) {
+        if(hops && address != MEM_FULL)
+            push_message(address);
+    } else {
+        neighbour_tree_changed();
+        fifo_root_reset();
+    }
+}
 
+void jungle_init(void)
+{
 #ifndef __SIMU__
-    // Send message to user.
-    send_usr_message(&b);
+    node_address = (uint16_t) hash(UNIQUE_ID, 12);
+#endif // __SIMU__
+    // The memory has just been cleaned.
+    quota_reset();
+}
+
+void jungle_lock(void)
+{
+    chMtxLock(&jungle_mtx);
+}
+
+void jungle_unlock(void)
+{
+    chMtxUnlock();
+}
+
+uint16_t jungle_store(struct Bucket *b)
+{
+    uint16_t address = tree_insert(b);
+    if(address != MEM_FULL)
+        quota_add(b->source_address);
+    return address;
+}
+
+void jungle_evict(uint16_t address)
+{
+    fifo_cancel(address, MESSAGE);
+    session_forget(address);
+    quota_remove(BUCKET_READ_FIELD(address, source_address, 16));
+    tree_erase(address);
+}
+
+int jungle_filter(const void *head, size_t size)
+{
+    uint8_t version = ((uint8_t *) head)[0] >> 4;
+    uint8_t type    = ((uint8_t *) head)[0] & 0x0F;
+    const uint8_t *body = ((uint8_t *) head) + HEADER_SIZE;
+
+#ifndef __TAG_MODE__
+    unless(version == PROTOCOL_VERSION)
+        return 1;
+#else
+    (void) version;
 #endif
+
+    // The DATA of our own session must reach session_handle_data.
+    if(type == DATA) {
+        if(((uint16_t *) body)[0] == node_address)
+            return 1;
+        body += DATA_HEADER_SIZE;
+    } else if(type != MESSAGE) {
+        return 1;
+    }
+
+    if(body + 8 > (uint8_t *) head + size)
+        return 1;
+
+    // The main thread may hold the memory for longer than the FIFO of the
+    // SX1231 lasts: rather keep the packet than wait for it.
+    uint64_t id;
+    memcpy(&id, body, 8);
+    return tree_peek_message(id) == END_REACHED;
+}
+
+void handle_dropped(struct Packet *packet)
+{
+    const uint8_t *buf = packet_data(packet);
+
+    uint8_t type    = ((uint8_t *) buf)[0] & 0x0F;
+    uint16_t source = ((uint16_t *) buf)[1];
+
+    // What handle_packet would have done with it.
+    neighbour_heard(source, packet->rssi);
+    if(type == MESSAGE) {
+        uint64_t id;
+        memcpy(&id, ((uint8_t *) buf) + HEADER_SIZE, 8);
+        uint16_t address = tree_find_message(id);
+        if(address != END_REACHED)
+            fifo_cancel(address, MESSAGE);
+    }
 }
 
-void handle_packet(const void *buf)
+void handle_packet(struct Packet *packet)
 {
+    uint8_t *buf = packet_data(packet);
+
     uint8_t version = ((uint8_t *) buf)[0] >> 4;
 #ifndef __TAG_MODE__
-    if (version == 0) {
+    if (version == PROTOCOL_VERSION) {
 #else
     (void) version;
 #endif
         uint8_t type    = ((uint8_t *) buf)[0] & 0x0F;
         uint8_t length  = ((uint8_t *) buf)[1];
+        uint16_t source = ((uint16_t *) buf)[1];
+        uint8_t *body = buf + HEADER_SIZE;
+
+        // Do not trust the length beyond what has been received.
+        if(packet->size < HEADER_SIZE)
+            return;
+        if(length > packet->size - HEADER_SIZE)
+            length = packet->size - HEADER_SIZE;
+
+        struct Neighbour *from = neighbour_heard(source, packet->rssi);
 
         switch(type) {
             case NODE:
-                handle_node(((uint8_t *) buf) + 2);
+                handle_node(body);
                 break;
             case ROOT:
-                handle_root(((uint8_t *) buf) + 2);
+                handle_root(body, length, from);
                 break;
             case LEAF:
-                handle_list(((uint8_t *) buf) + 2);
+                handle_list(body, from);
                 break;
             case MESSAGE:
-                handle_message(((uint8_t *) buf) + 2, length);
+                if(length > MESSAGE_MAX_SIZE)
+                    length = MESSAGE_MAX_SIZE;
+                if(length >= MESSAGE_HEADER_SIZE)
+                    handle_message(packet, length);
+                break;
+            case OFFER:
+                session_handle_offer(source, body, length);
+                break;
+            case ACCEPT:
+                session_handle_accept(source, body, length);
+                break;
+            case DATA:
+                if(length < DATA_HEADER_SIZE)
+                    break;
+                session_handle_data(source, body);
+                // Everyone hearing the message may keep it.
+                if(length > DATA_HEADER_SIZE + MESSAGE_MAX_SIZE)
+                    length = DATA_HEADER_SIZE + MESSAGE_MAX_SIZE;
+                if(length >= DATA_HEADER_SIZE + MESSAGE_HEADER_SIZE) {
+                    // Where the message of a MESSAGE would be.
+                    length -= DATA_HEADER_SIZE;
+                    memmove(body, body + DATA_HEADER_SIZE, length);
+                    handle_message(packet, length);
+                }
+                break;
+            case ACK:
+                if(length >= 4)
+                    session_handle_ack(source, body);
+                break;
+            case SINCE:
+                session_handle_since(source, body, length);
+                break;
+            case RECEIPT:
+                if(length)
+                    receipt_handle(body, length);
+                break;
             default:
                 break;
         }
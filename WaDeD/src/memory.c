@@ -55,6 +55,13 @@ static uint16_t freelist_head;
  */
 static uint16_t timestamps_head;
 
+/**
+ * @brief Head of the emission list.
+ *
+ * Point to the packet emitted last.
+ */
+static uint16_t emission_head;
+
 /**
  * @brief Keeps track of the number of stored packets.
  */
@@ -62,6 +69,7 @@ uint16_t memory_counter;
 #else // __SIMU__
 extern uint16_t freelist_head;
 extern uint16_t timestamps_head;
+extern uint16_t emission_head;
 extern uint16_t memory_counter;
 #endif // __SIMU__
 
@@ -103,6 +111,16 @@ static inline void set_next_timestamp(uint16_t position, uint16_t address)
     BUCKET_WRITE_FIELD(position, next_timestamp, 16, address);
 }
 
+static inline uint16_t get_next_emission(uint16_t position)
+{
+    return BUCKET_READ_FIELD(position, next_emission, 16);
+}
+
+static inline void set_next_emission(uint16_t position, uint16_t address)
+{
+    BUCKET_WRITE_FIELD(position, next_emission, 16, address);
+}
+
 /**
  * @brief Changes a bit of the state byte of a given bucket in fram.
  *
@@ -128,6 +146,11 @@ uint16_t memory_get_timestamps_head(void)
     return timestamps_head;
 }
 
+uint16_t memory_get_emission_head(void)
+{
+    return emission_head;
+}
+
 /**
  * @brief Reserve a space in memory to be allocated.
  *
@@ -276,6 +299,54 @@ static void insert_in_timestamps(uint16_t address, struct Bucket *bucket)
     }
 }
 
+/**
+ * @brief Correctly insert a message in the emission list.
+ *
+ * @param position The previous element in the list.
+ * @param address The address where the bucket will be inserted.
+ * @param bucket The bucket to be inserted.
+ */
+static void rec_insert_in_emissions(uint16_t position, uint16_t address,
+        struct Bucket *bucket)
+{
+    uint16_t next = get_next_emission(position);
+
+    // If we have reached the end of the list, insert it there.
+    if(next == NO_NEXT) {
+        bucket->next_emission = NO_NEXT;
+        set_next_emission(position, address);
+        return;
+    }
+
+    // The list is sorted by decreasing emission dates.
+    uint32_t ts = BUCKET_READ_FIELD(next, emission_date, 32);
+    if(ts <= bucket->emission_date) {
+        bucket->next_emission = next;
+        set_next_emission(position, address);
+    } else
+        rec_insert_in_emissions(next, address, bucket);
+}
+
+static void insert_in_emissions(uint16_t address, struct Bucket *bucket)
+{
+    if(emission_head == NO_NEXT) { // empty list
+        bucket->next_emission = NO_NEXT;
+        bucket->state |= 0x08;
+        emission_head = address;
+    } else if(BUCKET_READ_FIELD(emission_head, emission_date, 32)
+            <= bucket->emission_date) {
+        // Usual case, the message is the last emitted.
+        set_state(emission_head, 3, DOWN);
+
+        bucket->next_emission = emission_head;
+        bucket->state |= 0x08;
+        emission_head = address;
+    } else {
+        bucket->state &= ~0x08;
+        rec_insert_in_emissions(emission_head, address, bucket);
+    }
+}
+
 /**
  * @brief Insert a new bucket in memory and updates memory state accordingly.
  * The bucket should not be here already.
@@ -294,8 +365,16 @@ uint16_t memory_insert_bucket(struct Bucket * new_bucket)
     // Mark the bucket as used.
     new_bucket->state |= 0x01;
 
+    // Keep the length of the message, so that it can be sent without
+    // reading the whole bucket.
+    new_bucket->length = 0;
+    while(new_bucket->length < sizeof new_bucket->message - 1
+          && new_bucket->message[new_bucket->length])
+        new_bucket->length++;
+
     // Update lists.
     insert_in_timestamps(new_bucket_address, new_bucket);
+    insert_in_emissions(new_bucket_address, new_bucket);
     insert_in_ids(new_bucket_address, new_bucket);
 
     // Write the bucket in memory.
@@ -379,6 +458,40 @@ static void erase_from_timestamps(uint16_t address)
         rec_erase_from_timestamps(address, timestamps_head);
 }
 
+/**
+ * @brief Recursively suppresses a message from the emission list.
+ *
+ * @param address The bucket to be erased.
+ * @param position The previous bucket in the list.
+ */
+static void rec_erase_from_emissions(uint16_t address, uint16_t position)
+{
+    uint16_t next = get_next_emission(position);
+
+    if(next == NO_NEXT)
+        return;
+
+    if(next == address)
+        set_next_emission(position, get_next_emission(next));
+    else
+        rec_erase_from_emissions(address, next);
+}
+
+/**
+ * @brief Suppresses a message from the emission list.
+ *
+ * @param address The bucket to be erased.
+ */
+static void erase_from_emissions(uint16_t address)
+{
+    if(emission_head == address) {
+        emission_head = get_next_emission(address);
+        if(emission_head != NO_BUCKET)
+            set_state(emission_head, 3, UP);
+    } else
+        rec_erase_from_emissions(address, emission_head);
+}
+
 /**
  * @brief Free a bucket from memory.
  *
@@ -394,13 +507,16 @@ void memory_erase_bucket(uint16_t address)
 
     // Update memory state.
     erase_from_timestamps(address);
+    erase_from_emissions(address);
     erase_from_ids(address);
     add_to_freelist(address);
 
     memory_counter--;
 
-    if(!memory_counter)
+    if(!memory_counter) {
         timestamps_head = NO_BUCKET;
+        emission_head   = NO_BUCKET;
+    }
 }
 
 void memory_clean(void)
@@ -431,6 +547,15 @@ void memory_clean(void)
     memory_counter = 0;
     freelist_head = 0;
     timestamps_head = NO_BUCKET;
+    emission_head = NO_BUCKET;
+}
+
+uint16_t memory_skip_local(uint16_t address)
+{
+    while(address != NO_BUCKET
+            && (BUCKET_READ_FIELD(address, state, 8) & BUCKET_LOCAL))
+        address = read_next_id(address);
+    return address;
 }
 
 uint64_t memory_list_hash(uint16_t id)
@@ -441,18 +566,38 @@ uint64_t memory_list_hash(uint16_t id)
     uint64_t buf [10];
     buf[0] = 0;
 
+    // Each bucket of the list is read up to its state in a single transfer,
+    // the next one being read while the current one is handled.
+    uint8_t head [2][offsetof(struct Bucket, state) + 1];
+    int current = 0;
+    int i = 0;
+
+    if(address != NO_NEXT)
+        fram_read_start(BUCKETS_START + BUCKET_SIZE * address,
+                        head[current], sizeof head[current]);
+
     while(address != NO_NEXT) {
-        for(int i = 1 ; i < 10 ; i++) {
-            buf[i] = BUCKET_READ_FIELD(address, type.id, 64);
-            address = BUCKET_READ_FIELD(address, next_id, 16);
-            if(address == NO_NEXT) {
-                buf[0] = hash(buf, 8*(i+1));
-                return buf[0];
+        fram_read_wait();
+        memcpy(&address, head[current] + offsetof(struct Bucket, next_id),
+               sizeof address);
+        if(address != NO_NEXT)
+            fram_read_start(BUCKETS_START + BUCKET_SIZE * address,
+                            head[!current], sizeof head[!current]);
+
+        // Local messages are not part of the hash.
+        unless(head[current][offsetof(struct Bucket, state)] & BUCKET_LOCAL) {
+            if(i == 9) {
+                buf[0] = hash(buf, 80);
+                i = 0;
             }
+            memcpy(buf + (++i), head[current] + offsetof(struct Bucket, type),
+                   8);
         }
-        buf[0] = hash(buf, 80);
+        current = !current;
     }
 
+    if(i)
+        buf[0] = hash(buf, 8*(i+1));
     return buf[0];
 }
 
@@ -463,6 +608,7 @@ void memory_init(void)
 {
     memory_counter = 0;
     timestamps_head = NO_BUCKET;
+    emission_head = NO_BUCKET;
     freelist_head = NO_BUCKET;
 
     for(int i = 0 ; i < MEM_SIZE ; i++) {
@@ -471,6 +617,8 @@ void memory_init(void)
             memory_counter++;
             if(state & 0x02)
                 timestamps_head = i;
+            if(state & 0x08)
+                emission_head = i;
             continue;
         }
         if(BUCKET_READ_FIELD(i, type.empty.first, 8)) {
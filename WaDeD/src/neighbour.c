@@ -0,0 +1,179 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  neighbour.c
+ * @brief Keep track of the WaDeDs we hear, and of their synchronisation.
+ */
+
+#include <string.h>
+
+#include "neighbour.h"
+#include "role.h"
+
+#define unless(x) if(!(x))
+
+//USE_MEMORY
+static struct Neighbour neighbours [NEIGHBOUR_MAX];
+
+/**
+ * @brief Tell whether a neighbour has been heard recently.
+ *
+ * @param n   The neighbour.
+ * @param now The current system time.
+ *
+ * @return 1 if it is alive, 0 if not.
+ */
+static inline int is_alive(const struct Neighbour *n, systime_t now)
+{
+    return (n->state & NEIGHBOUR_USED)
+        && (systime_t) (now - n->last_seen) < NEIGHBOUR_TIMEOUT;
+}
+
+struct Neighbour *neighbour_find(uint16_t address)
+{
+    for(int i = 0; i < NEIGHBOUR_MAX; i++)
+        if((neighbours[i].state & NEIGHBOUR_USED)
+                && neighbours[i].address == address)
+            return neighbours + i;
+    return NULL;
+}
+
+struct Neighbour *neighbour_heard(uint16_t address, uint8_t rssi)
+{
+    systime_t now = chTimeNow();
+    struct Neighbour *n = neighbour_find(address);
+
+    if(n == NULL || !is_alive(n, now)) {
+        int alone = 1;
+        for(int i = 0; i < NEIGHBOUR_MAX; i++)
+            if(is_alive(neighbours + i, now))
+                alone = 0;
+
+        // Take a free place, or the place of the neighbour heard the longest
+        // time ago.
+        if(n == NULL) {
+            n = neighbours;
+            for(int i = 0; i < NEIGHBOUR_MAX; i++) {
+                unless(neighbours[i].state & NEIGHBOUR_USED) {
+                    n = neighbours + i;
+                    break;
+                }
+                if((systime_t) (now - neighbours[i].last_seen)
+                        > (systime_t) (now - n->last_seen))
+                    n = neighbours + i;
+            }
+        }
+
+        memset(n, 0, sizeof *n);
+        n->address   = address;
+        n->state     = NEIGHBOUR_USED | (alone ? NEIGHBOUR_CATCH_UP : 0);
+        n->last_sync = now - role_profile()->resync;
+        n->rssi      = rssi;
+    }
+
+    // A single packet faded or boosted does not change our mind on the link.
+    n->rssi      = (3 * n->rssi + rssi) / 4;
+    n->last_seen = now;
+    return n;
+}
+
+void neighbour_delivery(uint16_t address, uint8_t delivered, uint8_t lost)
+{
+    struct Neighbour *n = neighbour_find(address);
+    if(n == NULL)
+        return;
+
+    // Exponential average over the last 8 packets or so.
+    while(delivered--)
+        n->loss -= n->loss / 8;
+    while(lost--)
+        n->loss += (255 - n->loss) / 8;
+
+    if(n->loss >= NEIGHBOUR_LOSS_SLOW)
+        n->state |= NEIGHBOUR_SLOW;
+    else if(n->loss <= NEIGHBOUR_LOSS_FAST)
+        n->state &= ~NEIGHBOUR_SLOW;
+}
+
+int neighbour_fast(uint16_t address)
+{
+    struct Neighbour *n = neighbour_find(address);
+    return n != NULL && n->rssi <= NEIGHBOUR_FAST_RSSI
+        && !(n->state & NEIGHBOUR_SLOW);
+}
+
+int neighbour_fec(uint16_t address)
+{
+    struct Neighbour *n = neighbour_find(address);
+    return n != NULL && (n->rssi > NEIGHBOUR_FEC_RSSI
+            || ((n->state & NEIGHBOUR_SLOW) && n->loss > NEIGHBOUR_LOSS_FAST));
+}
+
+void neighbour_synced(struct Neighbour *n)
+{
+    n->state  |= NEIGHBOUR_IN_SYNC;
+    n->demand  = 0;
+}
+
+int neighbour_should_sync(struct Neighbour *n, const void *roots)
+{
+    systime_t now = chTimeNow();
+
+    // The neighbour is in the same state as during our last descent, which
+    // is still under way or has already given all it could.
+    unless(memcmp(n->roots, roots, sizeof n->roots)
+            || (n->state & NEIGHBOUR_IN_SYNC)
+            || (systime_t) (now - n->last_sync) >= role_profile()->resync)
+        return 0;
+
+    memcpy(n->roots, roots, sizeof n->roots);
+    n->state    &= ~NEIGHBOUR_IN_SYNC;
+    n->last_sync = now;
+    return 1;
+}
+
+void neighbour_tree_changed(void)
+{
+    systime_t now = chTimeNow();
+    for(int i = 0; i < NEIGHBOUR_MAX; i++) {
+        neighbours[i].state    &= ~NEIGHBOUR_IN_SYNC;
+        neighbours[i].last_sync = now - role_profile()->resync;
+    }
+}
+
+int neighbour_reaches(uint16_t address)
+{
+    systime_t now = chTimeNow();
+    for(int i = 0; i < NEIGHBOUR_MAX; i++)
+        if(is_alive(neighbours + i, now)
+                && route_filter_has(neighbours[i].filter, address))
+            return 1;
+    return 0;
+}
+
+int neighbour_all_synced(void)
+{
+    systime_t now = chTimeNow();
+    for(int i = 0; i < NEIGHBOUR_MAX; i++)
+        if(is_alive(neighbours + i, now)
+                && !(neighbours[i].state & NEIGHBOUR_IN_SYNC))
+            return 0;
+    return 1;
+}
@@ -0,0 +1,57 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  packet.c
+ * @brief Packet buffers, passed by pointer from the radio to the protocol.
+ */
+
+#include "packet.h"
+
+//USE_MEMORY
+static struct Packet packets [PACKET_BUFFERS];
+
+static MEMORYPOOL_DECL(pool, sizeof(struct Packet), NULL);
+
+/**
+ * @brief Number of packets in the pool, so that packet_alloc may wait for one.
+ */
+static SEMAPHORE_DECL(available, PACKET_BUFFERS);
+
+void packet_init(void)
+{
+    chPoolLoadArray(&pool, packets, PACKET_BUFFERS);
+}
+
+struct Packet *packet_alloc(systime_t timeout)
+{
+    if(chSemWaitTimeout(&available, timeout) != RDY_OK)
+        return NULL;
+
+    return chPoolAlloc(&pool);
+}
+
+void packet_release(struct Packet *packet)
+{
+    chSysLock();
+    chPoolFreeI(&pool, packet);
+    chSemSignalI(&available);
+    chSchRescheduleS();
+    chSysUnlock();
+}
@@ -0,0 +1,129 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  power.c
+ * @brief Put the MCU in a low power mode while all the threads wait.
+ */
+
+#include "hal.h"
+#include "power.h"
+#include "standby_mode.h"
+
+#define unless(x) if(!(x))
+
+/**
+ * @brief Longest single stop, which keeps the conversions within 32 bits.
+ */
+#define STOP_MAX S2ST(600)
+
+//USE_MEMORY
+static struct PowerStats stats;
+static uint32_t rest = 0; // Stop time not yet made into ticks, in STOP_HZ.
+
+void power_init(void)
+{
+    stop_init();
+}
+
+/**
+ * @brief Ticks left before the next virtual timer fires. Call with the system
+ * locked.
+ */
+static systime_t next_timer(void)
+{
+    if(vtlist.vt_next == (VirtualTimer *) &vtlist)
+        return STOP_MAX;
+    return vtlist.vt_next->vt_time;
+}
+
+/**
+ * @brief Tell whether a peripheral needs the clocks, which stop mode halts.
+ */
+static int clocks_needed(void)
+{
+    return USBD1.state == USB_SELECTED || USBD1.state == USB_ACTIVE ||
+           SPID1.state == SPI_ACTIVE || SPID2.state == SPI_ACTIVE;
+}
+
+/**
+ * @brief Stop the MCU until the next virtual timer or interrupt. Call with
+ * the interrupts disabled, and the SysTick too.
+ *
+ * @return The number of ticks spent in stop.
+ */
+static systime_t stop(systime_t left)
+{
+    if(left > STOP_MAX)
+        left = STOP_MAX;
+    uint32_t slices = (uint32_t) left * STOP_HZ / CH_FREQUENCY / STOP_SLICE;
+
+    rest += stop_enter(slices) * CH_FREQUENCY;
+
+    systime_t ticks = rest / STOP_HZ;
+    rest %= STOP_HZ;
+    return ticks;
+}
+
+void power_idle(void)
+{
+    chSysLock();
+    systime_t start = chTimeNow();
+    systime_t left = next_timer();
+    // PRIMASK, unlike the kernel lock, lets an interrupt end the WFI while
+    // holding it back until the low power mode is left.
+    __disable_irq();
+    chSysUnlock();
+
+    unless(left >= POWER_STOP_MIN && !clocks_needed()) {
+        __WFI();
+        __enable_irq();
+        chSysLock();
+        stats.sleep += chTimeNow() - start;
+        chSysUnlock();
+        return;
+    }
+
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    systime_t ticks = 0;
+    // An interrupt already pending would end the stop at once.
+    unless(SCB->ICSR & (SCB_ICSR_ISRPENDING_Msk | SCB_ICSR_PENDSTSET_Msk)) {
+        ticks = stop(left);
+        stats.stops++;
+    }
+
+    // The ticks missed are played at once, firing the timers which are due.
+    chSysLock();
+    for(systime_t n = 0; n < ticks; n++)
+        chVTDoTickI();
+    stats.stop += ticks;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    __enable_irq();
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
+void power_stats(struct PowerStats *s)
+{
+    chSysLock();
+    *s = stats;
+    s->run = chTimeNow() - stats.sleep - stats.stop;
+    chSysUnlock();
+    fram_stats(&s->fram);
+}
@@ -0,0 +1,180 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  quota.c
+ * @brief Per-source quotas, sharing the memory fairly between the sources.
+ */
+
+#include "quota.h"
+#include "memory.h"
+#include "tree.h"
+#include "jungle.h"
+
+/**
+ * @brief The usage of a source.
+ */
+struct Quota {
+    uint16_t source;
+    uint16_t count; // Messages stored, 0 for a free place.
+    uint16_t limit;
+};
+
+extern uint16_t memory_counter;
+
+//USE_MEMORY
+static struct Quota quotas [QUOTA_SOURCES];
+
+/**
+ * @brief Quotas set for sources not stored yet, kept apart so that they are
+ * not lost when the source has no message.
+ */
+static struct {
+    uint16_t source;
+    uint16_t limit;
+} limits [QUOTA_SOURCES];
+static int limits_size = 0;
+
+/**
+ * @brief The source whose messages are evicted, for not_from().
+ */
+static uint16_t victim_source;
+
+/**
+ * @brief Find the entry of a source.
+ *
+ * @param source The source address.
+ *
+ * @return The entry, or NULL if the source is not tracked.
+ */
+static struct Quota *find(uint16_t source)
+{
+    for(int i = 0; i < QUOTA_SOURCES; i++)
+        if(quotas[i].count && quotas[i].source == source)
+            return quotas + i;
+    return NULL;
+}
+
+/**
+ * @brief Get the quota of a source.
+ *
+ * @param source The source address.
+ *
+ * @return Its quota.
+ */
+static uint16_t limit_of(uint16_t source)
+{
+    for(int i = 0; i < limits_size; i++)
+        if(limits[i].source == source)
+            return limits[i].limit;
+    return QUOTA_DEFAULT;
+}
+
+void quota_add(uint16_t source)
+{
+    struct Quota *q = find(source);
+    if(q == NULL)
+        for(int i = 0; i < QUOTA_SOURCES; i++)
+            if(!quotas[i].count) {
+                q = quotas + i;
+                q->source = source;
+                q->limit  = limit_of(source);
+                break;
+            }
+
+    if(q)
+        q->count++;
+}
+
+void quota_remove(uint16_t source)
+{
+    struct Quota *q = find(source);
+    if(q)
+        q->count--;
+}
+
+void quota_reset(void)
+{
+    for(int i = 0; i < QUOTA_SOURCES; i++)
+        quotas[i].count = 0;
+}
+
+void quota_set(uint16_t source, uint16_t limit)
+{
+    struct Quota *q = find(source);
+    if(q)
+        q->limit = limit;
+
+    for(int i = 0; i < limits_size; i++)
+        if(limits[i].source == source) {
+            limits[i].limit = limit;
+            return;
+        }
+    if(limits_size < QUOTA_SOURCES) {
+        limits[limits_size].source = source;
+        limits[limits_size].limit  = limit;
+        limits_size++;
+    }
+}
+
+/**
+ * @brief Tell whether a message is not from the source being evicted.
+ *
+ * @param source      The source address of the message.
+ * @param destination Its destination address.
+ *
+ * @return 1 if it is not, 0 if it is.
+ */
+static int not_from(uint16_t source, uint16_t destination)
+{
+    (void) destination;
+    return source != victim_source;
+}
+
+int quota_admit(const struct Bucket *b)
+{
+    if(memory_counter < MEM_SIZE)
+        return 1;
+
+    // Find the source exceeding its quota the most.
+    struct Quota *worst = NULL;
+    for(int i = 0; i < QUOTA_SOURCES; i++)
+        if(quotas[i].count > quotas[i].limit && (worst == NULL
+                    || quotas[i].count - quotas[i].limit
+                       > worst->count - worst->limit))
+            worst = quotas + i;
+
+    // Nobody abuses: the insertion fails as usual.
+    if(worst == NULL)
+        return 1;
+
+    // The newcomer is the abuser itself, it keeps what it already has.
+    if(worst->source == b->source_address)
+        return 0;
+
+    // Its messages are likely the freshest, far from the first to expire:
+    // walk the whole memory for them.
+    victim_source = worst->source;
+    uint16_t victim = tree_evictable(not_from, MEM_SIZE);
+    if(victim == END_REACHED)
+        return 1;
+
+    jungle_evict(victim);
+    return 1;
+}
@@ -0,0 +1,396 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  radio.c
+ * @brief Drive the SX1231 from a thread of its own.
+ */
+
+#include <string.h>
+
+#include "radio.h"
+#include "dio.h"
+#include "dash7.h"
+#include "channel.h"
+#include "airtime.h"
+
+/**
+ * @brief The packet submitted.
+ */
+static struct {
+    size_t    size;
+    tx_fill_t fill;
+    int       class;
+    int       session;
+} tx;
+
+/**
+ * @brief Contention windows of each class, in slots: the first one, and the
+ * largest one it doubles up to.
+ */
+static const struct {
+    uint16_t min;
+    uint16_t max;
+} windows [] = {
+    [RADIO_URGENT] = {2, 8},
+    [RADIO_NORMAL] = {4, 32},
+    [RADIO_BULK]   = {8, 64},
+};
+
+/**
+ * @brief State of the random generator used for the backoffs.
+ */
+static uint32_t seed;
+
+/**
+ * @brief 1 while we are on a coded channel.
+ */
+static uint8_t coded = 0;
+
+#ifdef __LOW_POWER__
+/**
+ * @brief Time spent sending background frames to wake the neighbours up, in
+ * us.
+ */
+#define RADIO_LPL_FLOOD_US \
+    ((uint32_t) (RADIO_LPL_PERIOD + RADIO_LPL_SNIFF) * (1000000 / CH_FREQUENCY))
+
+/**
+ * @brief Longest wait announced by a background frame, in ms: a flood lasts
+ * no longer.
+ */
+#define RADIO_LPL_ETA_MAX \
+    ((uint32_t) (RADIO_LPL_PERIOD + RADIO_LPL_SNIFF) * 1000 / CH_FREQUENCY)
+
+/**
+ * @brief A background frame: who is waking its neighbours up, and in how many
+ * ms it sends its packet.
+ */
+struct Background {
+    uint16_t source;
+    uint16_t eta;
+};
+
+/**
+ * @brief The background frame being sent.
+ */
+static struct Background background;
+
+/**
+ * @brief Until when the neighbourhood is awake.
+ */
+static systime_t awake_until = 0;
+#endif // __LOW_POWER__
+
+//USE_MEMORY
+static msg_t submitted_buffer [1];
+static MAILBOX_DECL(submitted, submitted_buffer, 1);
+static msg_t sent_buffer [1];
+static MAILBOX_DECL(sent, sent_buffer, 1);
+static msg_t completed_buffer [PACKET_BUFFERS];
+static MAILBOX_DECL(completed, completed_buffer, PACKET_BUFFERS);
+
+static Thread *radio_tp;
+
+static WORKING_AREA(WA_radio, 512);
+
+/**
+ * @brief Draw a backoff.
+ *
+ * @param window The contention window, in slots.
+ *
+ * @return The backoff.
+ */
+static systime_t backoff(uint16_t window)
+{
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return RADIO_SLOT * (seed % window);
+}
+
+/**
+ * @brief Filter the packets being received, see jungle_filter.
+ *
+ * @param head The first bytes of the packet.
+ * @param size Their number.
+ *
+ * @return 1 to receive the rest of the packet, 0 to drop it.
+ */
+static int radio_filter(const void *head, size_t size)
+{
+#ifdef __FEC__
+    if (coded) {
+        // The code is systematic: the packet is there, but whitened.
+        uint8_t clear [VALUE_FIFO_THRESH];
+        if (size > sizeof clear)
+            size = sizeof clear;
+        memcpy(clear, head, size);
+        fec_whiten(clear, size);
+        return jungle_filter(clear, size);
+    }
+#endif // __FEC__
+    return jungle_filter(head, size);
+}
+
+/**
+ * @brief Note that the neighbourhood is awake, since we just heard or sent a
+ * packet.
+ */
+static inline void keep_awake(void)
+{
+#ifdef __LOW_POWER__
+    awake_until = chTimeNow() + RADIO_LPL_AWAKE;
+#endif // __LOW_POWER__
+}
+
+#ifdef __LOW_POWER__
+/**
+ * @brief Fill a chunk with the background frame, see tx_fill_t.
+ */
+static void copy_background(void *chunk, size_t offset, size_t size)
+{
+    memcpy(chunk, ((uint8_t *) &background) + offset, size);
+}
+
+/**
+ * @brief Wake the neighbours up, sending background frames for a whole
+ * period so that each of them sniffs one.
+ */
+static void flood(void)
+{
+    systime_t end = chTimeNow() + RADIO_LPL_PERIOD + RADIO_LPL_SNIFF;
+    background.source = node_address;
+
+    select_packet_mode(BACKGROUND_MODE);
+    for (;;) {
+        int32_t left = end - chTimeNow();
+        if (left <= 0)
+            break;
+        background.eta = (uint32_t) left * 1000 / CH_FREQUENCY;
+        sx_transmit(sizeof background, copy_background);
+        airtime_spent(CHANNEL_RENDEZVOUS, sizeof background);
+    }
+    select_packet_mode(FOREGROUND_MODE);
+}
+
+/**
+ * @brief Sleep for a period, or until a packet is submitted, then sniff for a
+ * background frame.
+ *
+ * @return 1 if a neighbour is waking us up, in which case we slept until its
+ * packet, 0 if not.
+ */
+static int sniff(void)
+{
+    struct Background frame;
+
+    sx_mode(SLEEP);
+    if (chEvtWaitAnyTimeout(DIO_WAKE_MASK, RADIO_LPL_PERIOD))
+        return 0;
+
+    select_packet_mode(BACKGROUND_MODE);
+    int size = receive_packet(&frame, sizeof frame, RADIO_LPL_SNIFF);
+    select_packet_mode(FOREGROUND_MODE);
+    sx_mode(SLEEP);
+    if (size != sizeof frame)
+        return 0;
+
+    // A corrupted or foreign frame must not keep us deaf.
+    if (frame.eta > RADIO_LPL_ETA_MAX)
+        frame.eta = RADIO_LPL_ETA_MAX;
+    chThdSleepMilliseconds(frame.eta);
+    return 1;
+}
+#endif // __LOW_POWER__
+
+/**
+ * @brief Report the end of the packet submitted.
+ *
+ * @param status SX1231_ERR
+ */
+static void tx_done(int status)
+{
+    chMBPost(&sent, (msg_t) status, TIME_INFINITE);
+}
+
+static msg_t radio_thread(void *arg)
+{
+    (void) arg;
+    struct Packet *rx = NULL;
+    msg_t     msg;
+    int       pending  = 0; // The packet submitted waits for the channel.
+    int       attempts = 0;
+    uint16_t  window   = 0;
+    systime_t deadline = 0;
+    uint8_t   channel  = CHANNEL_RENDEZVOUS; // Selected by dash7_init.
+
+    // The DIO events are delivered to the thread registering them.
+    dio_init();
+
+    seed = ((uint32_t) node_address << 16) | (chTimeNow() & 0xFFFF) | 1;
+
+    for(;;) {
+        // A submission interrupts the wait for a packet, but not its
+        // reception.
+        if (!pending && chMBFetch(&submitted, &msg, TIME_IMMEDIATE) == RDY_OK) {
+            pending  = 1;
+            attempts = 0;
+            window   = windows[tx.class].min;
+            deadline = chTimeNow() + backoff(window);
+        }
+
+        // Only the session packets go on the data channel: the others wait
+        // for their turn on the rendezvous channel.
+        systime_t dwell;
+        uint8_t wanted = channel_now(&dwell);
+        if (pending && !tx.session)
+            wanted = CHANNEL_RENDEZVOUS;
+        if (wanted != channel) {
+            sx_mode(STDBY);
+            select_channel(wanted & ~CHANNEL_FEC);
+            coded = (wanted & CHANNEL_FEC) != 0;
+            select_coding(coded);
+            channel = wanted;
+        }
+
+#ifdef __LOW_POWER__
+        // The sessions have their neighbour awake.
+        if (channel == CHANNEL_RENDEZVOUS
+                && (int32_t) (awake_until - chTimeNow()) <= 0) {
+            if (pending) {
+                // The background frames count against the duty cycle.
+                if (!airtime_affords(RADIO_LPL_FLOOD_US)) {
+                    pending = 0;
+                    tx_done(CHANNEL_BUSY);
+                    continue;
+                }
+                flood();
+            } else if (!sniff()) {
+                continue;
+            }
+            keep_awake();
+        }
+#endif // __LOW_POWER__
+
+        systime_t timeout = TIME_INFINITE;
+        if (pending) {
+            int32_t left = deadline - chTimeNow();
+            if (left <= 0) {
+                if (sx_channel_clear(RADIO_CCA_TIME)) {
+                    pending = 0;
+                    keep_awake();
+                    size_t size = tx.size;
+                    tx_fill_t fill = tx.fill;
+#ifdef __FEC__
+                    if (coded) {
+                        size = fec_start(tx.size, tx.fill);
+                        fill = fec_fill;
+                    }
+#endif // __FEC__
+                    int status = sx_transmit(size, fill);
+                    airtime_spent(channel, size);
+                    tx_done(status);
+                    continue;
+                }
+                channel_busy(channel);
+                if (++attempts > RADIO_TX_RETRIES) {
+                    pending = 0;
+                    tx_done(CHANNEL_BUSY);
+                } else {
+                    if (window < windows[tx.class].max)
+                        window *= 2;
+                    deadline = chTimeNow() + backoff(window);
+                }
+                continue;
+            }
+            // Keep listening during the backoff.
+            timeout = left;
+        }
+
+        // Come back in time for the next hop.
+        if (dwell < timeout)
+            timeout = dwell;
+
+        // The buffers are all being handled: wait until one is released.
+        if (rx == NULL) {
+            rx = packet_alloc(timeout);
+            if (rx == NULL)
+                continue;
+        }
+
+        uint8_t *data = packet_data(rx);
+        rx->size = receive_packet_filtered(data, PACKET_RX_SIZE, timeout,
+                                           radio_filter);
+        if (rx->size == TIMEOUT)
+            continue;
+        keep_awake();
+#ifdef __FEC__
+        if (coded && rx->size >= 0)
+            rx->size = fec_decode(data, rx->size);
+        else if (coded && rx->size == RECEIVE_DROPPED)
+            fec_whiten(data, VALUE_FIFO_THRESH);
+#endif // __FEC__
+        if (rx->size == RECEIVE_CRC_ERROR)
+            channel_busy(channel);
+
+        rx->rssi = sx_rssi();
+        chMBPost(&completed, (msg_t) rx, TIME_INFINITE);
+        rx = NULL;
+    }
+
+    return 0;
+}
+
+void radio_init(void)
+{
+    packet_init();
+    radio_tp = chThdCreateStatic(WA_radio, sizeof WA_radio, HIGHPRIO,
+                                 radio_thread, NULL);
+}
+
+int radio_send(size_t size, tx_fill_t fill, int class, int session)
+{
+    msg_t status;
+    tx.size    = size;
+    tx.fill    = fill;
+    tx.class   = class;
+    tx.session = session;
+    chMBPost(&submitted, 0, TIME_INFINITE);
+    chEvtSignal(radio_tp, DIO_WAKE_MASK);
+    chMBFetch(&sent, &status, TIME_INFINITE);
+    return (int) status;
+}
+
+int radio_wait(systime_t timeout, struct Packet **rx)
+{
+    msg_t msg;
+    if (chMBFetch(&completed, &msg, timeout) != RDY_OK)
+        return RADIO_TIMEOUT;
+
+    *rx = (struct Packet *) msg;
+    return RADIO_RECEIVED;
+}
+
+void radio_retune(void)
+{
+    if (radio_tp != NULL)
+        chEvtSignal(radio_tp, DIO_WAKE_MASK);
+}
@@ -0,0 +1,197 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  receipt.c
+ * @brief Delivery receipts, to free the messages delivered to their host.
+ */
+
+#include <string.h>
+
+#include "receipt.h"
+#include "jungle.h"
+#include "fifo.h"
+#include "tree.h"
+#include "timestamp.h"
+
+#define unless(x) if(!(x))
+
+/**
+ * @brief A delivered message.
+ */
+struct Tombstone {
+    uint64_t id;
+    uint32_t until;   // Expiration date of the message, 0 for a free place.
+    uint8_t  pending; // 1 if its receipt is to be broadcast.
+};
+
+static MUTEX_DECL(receipt_mtx);
+
+//USE_MEMORY
+static struct Tombstone tombstones [TOMBSTONE_MAX];
+
+/**
+ * @brief Tell how long a tombstone has left.
+ *
+ * @param t   The tombstone.
+ * @param now The current date.
+ *
+ * @return The time left in ms, or 0 if it has expired.
+ */
+static uint32_t left(const struct Tombstone *t, uint32_t now)
+{
+    uint32_t left = t->until - now;
+    return left > TOMBSTONE_LIFE ? 0 : left;
+}
+
+/**
+ * @brief Find the tombstone of a message. Call with receipt_mtx locked.
+ *
+ * @param id  The id of the message.
+ * @param now The current date.
+ *
+ * @return The tombstone, or NULL if there is none.
+ */
+static struct Tombstone *find(uint64_t id, uint32_t now)
+{
+    for(int i = 0; i < TOMBSTONE_MAX; i++)
+        if(tombstones[i].until && tombstones[i].id == id) {
+            unless(left(tombstones + i, now)) {
+                tombstones[i].until = 0; // Expired.
+                return NULL;
+            }
+            return tombstones + i;
+        }
+    return NULL;
+}
+
+/**
+ * @brief Add a tombstone, in place of the one to expire first if the table
+ * is full. Call with receipt_mtx locked.
+ *
+ * @param id    The id of the message.
+ * @param until Its expiration date.
+ * @param now   The current date.
+ */
+static void add(uint64_t id, uint32_t until, uint32_t now)
+{
+    struct Tombstone *t = tombstones;
+    for(int i = 0; i < TOMBSTONE_MAX; i++) {
+        // A free place, or an expired tombstone.
+        if(!tombstones[i].until || !left(tombstones + i, now)) {
+            t = tombstones + i;
+            break;
+        }
+        if(left(tombstones + i, now) < left(t, now))
+            t = tombstones + i;
+    }
+
+    // A date in the past, or further than the life of a message, comes from
+    // a clock which does not agree with ours: keep it for a whole life.
+    if(until - now > TOMBSTONE_LIFE)
+        until = now + TOMBSTONE_LIFE;
+
+    t->id      = id;
+    t->until   = until ? until : 1;
+    t->pending = 1;
+}
+
+/**
+ * @brief Record a delivered message, erase it and queue its receipt.
+ *
+ * @param id    The id of the message.
+ * @param until Its expiration date.
+ */
+static void bury(uint64_t id, uint32_t until)
+{
+    uint32_t now = get_timestamp();
+
+    chMtxLock(&receipt_mtx);
+    int known = find(id, now) != NULL;
+    unless(known)
+        add(id, until, now);
+    chMtxUnlock();
+
+    if(known)
+        return;
+
+    uint16_t address = tree_find_message(id);
+    if(address != END_REACHED)
+        jungle_evict(address);
+    fifo_push(0, RECEIPT);
+}
+
+void receipt_delivered(uint64_t id, uint32_t expiration)
+{
+    bury(id, expiration);
+}
+
+int receipt_has(uint64_t id)
+{
+    chMtxLock(&receipt_mtx);
+    struct Tombstone *t = find(id, get_timestamp());
+    if(t)
+        t->pending = 1;
+    chMtxUnlock();
+
+    unless(t)
+        return 0;
+    fifo_push(0, RECEIPT);
+    return 1;
+}
+
+void receipt_handle(const void *buf, uint8_t length)
+{
+    uint8_t n = ((uint8_t *) buf)[0];
+    if(length < 1 + 12 * n)
+        return;
+
+    for(int i = 0; i < n; i++) {
+        uint64_t id;
+        uint32_t until;
+        memcpy(&id,    ((uint8_t *) buf) + 1 + 12 * i, 8);
+        memcpy(&until, ((uint8_t *) buf) + 1 + 12 * i + 8, 4);
+        bury(id, until);
+    }
+}
+
+uint8_t receipt_put(uint8_t *body)
+{
+    uint8_t n = 0;
+
+    chMtxLock(&receipt_mtx);
+    for(int i = 0; i < TOMBSTONE_MAX && n < RECEIPT_BATCH; i++)
+        if(tombstones[i].until && tombstones[i].pending) {
+            memcpy(body + 1 + 12 * n, &tombstones[i].id, 8);
+            memcpy(body + 1 + 12 * n + 8, &tombstones[i].until, 4);
+            tombstones[i].pending = 0;
+            n++;
+        }
+    chMtxUnlock();
+
+    // Some are left for another packet.
+    for(int i = 0; i < TOMBSTONE_MAX; i++)
+        if(tombstones[i].until && tombstones[i].pending) {
+            fifo_push(0, RECEIPT);
+            break;
+        }
+
+    body[0] = n;
+    return 1 + 12 * n;
+}
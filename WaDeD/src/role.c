@@ -0,0 +1,101 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  role.c
+ * @brief Profiles of the two kinds of WaDeD: stones and zombies.
+ */
+
+#include "role.h"
+#include "jungle.h"
+#include "fifo.h"
+#include "tree.h"
+#include "route.h"
+#include "neighbour.h"
+#include "session.h"
+#include "client_cmd.h"
+
+#define unless(x) if(!(x))
+
+extern uint16_t memory_counter;
+
+//USE_MEMORY
+static const struct Role profiles[] = {
+    [ROLE_STONE] = {
+        .root_interval_min = ROOT_INTERVAL_MIN,
+        .root_interval_max = ROOT_INTERVAL_MAX,
+        .resync            = NEIGHBOUR_RESYNC,
+        .relay_cache       = MEM_SIZE,
+        .session_threshold = SESSION_THRESHOLD,
+    },
+    [ROLE_ZOMBIE] = {
+        .root_interval_min = ZOMBIE_ROOT_INTERVAL_MIN,
+        .root_interval_max = ZOMBIE_ROOT_INTERVAL_MAX,
+        .resync            = ZOMBIE_RESYNC,
+        .relay_cache       = ZOMBIE_RELAY_CACHE,
+        .session_threshold = 4 * SESSION_THRESHOLD,
+    },
+};
+
+static uint8_t role = DEFAULT_ROLE;
+
+void role_set(uint8_t r)
+{
+    if(r > ROLE_ZOMBIE || r == role)
+        return;
+    role = r;
+    fifo_root_reset();
+}
+
+uint8_t role_get(void)
+{
+    return role;
+}
+
+const struct Role *role_profile(void)
+{
+    return profiles + role;
+}
+
+/**
+ * @brief Tell whether a message concerns our host.
+ *
+ * @param source      The source address of the message.
+ * @param destination Its destination address.
+ *
+ * @return 1 if it is from or to our host, 0 if not.
+ */
+static int own(uint16_t source, uint16_t destination)
+{
+    return source == host_id || destination == host_id;
+}
+
+int role_admit(const struct Bucket *b)
+{
+    if(role == ROLE_STONE || memory_counter < profiles[role].relay_cache)
+        return 1;
+
+    // The cache is full: make room by evicting a message to relay.
+    uint16_t victim = tree_evictable(own, ROUTE_EVICT_SCAN);
+    if(victim == END_REACHED)
+        return own(b->source_address, b->destination_address);
+
+    jungle_evict(victim);
+    return 1;
+}
@@ -0,0 +1,102 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  route.c
+ * @brief Summaries of the addresses reachable through each WaDeD.
+ */
+
+#include <string.h>
+
+#include "route.h"
+#include "neighbour.h"
+#include "client_cmd.h"
+
+#define unless(x) if(!(x))
+
+#define FILTER_BITS (8 * ROUTE_FILTER_SIZE)
+
+//USE_MEMORY
+static uint8_t   current  [ROUTE_FILTER_SIZE]; /**< Addresses seen lately. */
+static uint8_t   previous [ROUTE_FILTER_SIZE]; /**< The generation before. */
+static systime_t period_start = 0;
+
+/**
+ * @brief Compute the positions of an address in a filter.
+ *
+ * @param address The address.
+ * @param bits    The 3 positions.
+ */
+static void positions(uint16_t address, uint8_t bits[3])
+{
+    uint32_t x = address * 2654435761u;
+    bits[0] = (x >> 25) % FILTER_BITS;
+    bits[1] = (x >> 18) % FILTER_BITS;
+    bits[2] = (x >> 11) % FILTER_BITS;
+}
+
+/**
+ * @brief Start a new generation if the current one is over.
+ */
+static void age(void)
+{
+    systime_t now = chTimeNow();
+    if((systime_t) (now - period_start) < ROUTE_PERIOD)
+        return;
+
+    period_start = now;
+    memcpy(previous, current, ROUTE_FILTER_SIZE);
+    memset(current, 0, ROUTE_FILTER_SIZE);
+
+    // Our host is always reachable through us.
+    if(host_id != 0xFFFF)
+        route_add(host_id);
+}
+
+void route_add(uint16_t address)
+{
+    uint8_t bits[3];
+    positions(address, bits);
+    for(int i = 0; i < 3; i++)
+        current[bits[i] / 8] |= 1 << (bits[i] % 8);
+}
+
+void route_get_filter(void *buf)
+{
+    age();
+    for(int i = 0; i < ROUTE_FILTER_SIZE; i++)
+        ((uint8_t *) buf)[i] = current[i] | previous[i];
+}
+
+int route_filter_has(const void *filter, uint16_t address)
+{
+    uint8_t bits[3];
+    positions(address, bits);
+    for(int i = 0; i < 3; i++)
+        unless(((uint8_t *) filter)[bits[i] / 8] & (1 << (bits[i] % 8)))
+            return 0;
+    return 1;
+}
+
+int route_reachable(uint16_t address)
+{
+    uint8_t filter[ROUTE_FILTER_SIZE];
+    route_get_filter(filter);
+    return route_filter_has(filter, address) || neighbour_reaches(address);
+}
@@ -0,0 +1,642 @@
+/*
+ *  WaDeD - Short messages mesh network
+ *
+ *  Copyright (C) 2013 WaDeD-ROSE <waded-rose@googlegroups.com>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file  session.c
+ * @brief Unicast bulk-transfer sessions between two WaDeDs.
+ */
+
+#include "session.h"
+#include "jungle.h"
+#include "fifo.h"
+#include "tree.h"
+#include "channel.h"
+#include "neighbour.h"
+
+#define unless(x) if(!(x))
+
+// States of a session.
+#define SESSION_IDLE    0
+#define SESSION_OFFERED 1 /**< OFFER sent, waiting for the ACCEPT. */
+#define SESSION_ACTIVE  2
+#define SESSION_SINCE   3 /**< SINCE sent, waiting for the first DATA. */
+
+/**
+ * @brief The session in which we send messages.
+ *
+ * The sequence number seq is carried by the message at window[seq %
+ * SESSION_WINDOW]. The bitmaps acked and to_send are relative to base, the
+ * oldest unacknowledged sequence number. Once the backlog is empty, the window
+ * is filled by walking the messages emitted since a SINCE request, if any.
+ * A message erased while in the window leaves END_REACHED, sent as an empty
+ * DATA so that the sequence goes on.
+ */
+static struct {
+    uint16_t  peer;
+    uint8_t   state;
+    uint8_t   retries;
+    uint8_t   base;     // Oldest unacknowledged sequence number.
+    uint8_t   next;     // Next sequence number to enter the window.
+    uint8_t   acked;    // Packets of the window acknowledged.
+    uint8_t   to_send;  // Packets of the window to (re)send.
+    systime_t deadline; // When to send again if nothing is acknowledged.
+    uint16_t  window [SESSION_WINDOW];
+    uint16_t  backlog [SESSION_BACKLOG];
+    int       backlog_head;
+    int       backlog_size;
+    uint8_t   since_on; // 1 while walking the messages of a SINCE request.
+    uint16_t  cursor;   // Last message walked.
+    uint8_t   ahead;    // 1 if cursor is the next message to walk instead.
+    uint32_t  since;    // Oldest emission date requested.
+    uint8_t   joined;   // 1 while we are on the data channel for it.
+} tx;
+
+/**
+ * @brief The session in which we receive messages.
+ */
+static struct {
+    uint16_t  peer;
+    uint8_t   state;
+    uint8_t   base;      // Oldest sequence number not received.
+    uint8_t   received;  // Packets received after base, relative to base.
+    uint8_t   since_ack; // Packets received since our last ACK.
+    uint8_t   pending;   // 1 if we have to send an ACCEPT or an ACK.
+    uint8_t   fresh;     // 1 if a DATA arrived since our last transmission.
+    uint8_t   retries;   // SINCE sent without answer.
+    systime_t last;      // Last time we heard the peer.
+    uint32_t  since;     // The date of our SINCE request.
+    uint8_t   channel;   // The data channel proposed by the sender.
+    uint8_t   joined;    // 1 while we are on the data channel for it.
+} rx;
+
+/**
+ * @brief Tell whether a message is already handled by the sending session.
+ *
+ * @param address The address of the message in FRAM.
+ *
+ * @return 1 if it is in the backlog or in the window, 0 if not.
+ */
+static int tx_has(uint16_t address)
+{
+    for(int i = 0; i < tx.backlog_size; i++)
+        if(tx.backlog[(tx.backlog_head + i) % SESSION_BACKLOG] == address)
+            return 1;
+    for(uint8_t s = tx.base; s != tx.next; s++)
+        if(tx.window[s % SESSION_WINDOW] == address)
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief Go back from the data channel of the sending session, if we are on
+ * it.
+ */
+static void tx_leave(void)
+{
+    if(tx.joined)
+        channel_leave();
+    tx.joined = 0;
+}
+
+/**
+ * @brief Go back from the data channel of the receiving session, if we are
+ * on it.
+ */
+static void rx_leave(void)
+{
+    if(rx.joined)
+        channel_leave();
+    rx.joined = 0;
+}
+
+/**
+ * @brief Close the sending session, giving the messages not acknowledged yet
+ * back to the fifo.
+ */
+static void tx_abort(void)
+{
+    for(uint8_t s = tx.base; s != tx.next; s++)
+        unless(tx.acked & (1 << (uint8_t) (s - tx.base))
+                || tx.window[s % SESSION_WINDOW] == END_REACHED)
+            fifo_push(tx.window[s % SESSION_WINDOW], MESSAGE);
+    for(int i = 0; i < tx.backlog_size; i++)
+        fifo_push(tx.backlog[(tx.backlog_head + i) % SESSION_BACKLOG], MESSAGE);
+
+    tx.state        = SESSION_IDLE;
+    tx.backlog_size = 0;
+    tx.since_on     = 0;
+    tx_leave();
+}
+
+/**
+ * @brief Move messages from the backlog to the window while there is room.
+ */
+static void tx_fill(void)
+{
+    while((uint8_t) (tx.next - tx.base) < SESSION_WINDOW) {
+        uint16_t address;
+        if(tx.backlog_size) {
+            address = tx.backlog[tx.backlog_head];
+            tx.backlog_head = (tx.backlog_head + 1) % SESSION_BACKLOG;
+            tx.backlog_size--;
+        } else if(tx.since_on) {
+            unless(tx.ahead)
+                tx.cursor = tree_next_emitted(tx.cursor, tx.since);
+            tx.ahead = 0;
+            if(tx.cursor == END_REACHED) {
+                tx.since_on = 0;
+                break;
+            }
+            if(tx_has(tx.cursor))
+                continue;
+            address = tx.cursor;
+        } else
+            break;
+
+        tx.window[tx.next % SESSION_WINDOW] = address;
+        tx.to_send |= 1 << (uint8_t) (tx.next - tx.base);
+        tx.next++;
+    }
+}
+
+/**
+ * @brief Start a sending session with no backlog.
+ *
+ * @param peer  The neighbour to send to.
+ * @param state The state of the session.
+ */
+static void tx_open(uint16_t peer, uint8_t state)
+{
+    tx.peer         = peer;
+    tx.state        = state;
+    tx.retries      = 0;
+    tx.deadline     = chTimeNow();
+    tx.backlog_head = 0;
+    tx.backlog_size = 0;
+    tx.since_on     = 0;
+    tx.ahead        = 0;
+    tx.base         = 0;
+    tx.next         = 0;
+    tx.acked        = 0;
+    tx.to_send      = 0;
+    tx.joined       = 0;
+}
+
+int session_push(uint16_t peer, const uint16_t *addresses, uint8_t n,
+                 int open)
+{
+    if(tx.state != SESSION_IDLE && tx.peer != peer)
+        return 0;
+
+    if(tx.state == SESSION_IDLE) {
+        unless(open)
+            return 0;
+        tx_open(peer, SESSION_OFFERED);
+    }
+
+    for(int i = 0; i < n; i++) {
+        if(tx_has(addresses[i]))
+            continue;
+        if(tx.backlog_size == SESSION_BACKLOG) {
+            // No room left, send it the usual way.
+            fifo_push(addresses[i], MESSAGE);
+            continue;
+        }
+        tx.backlog[(tx.backlog_head + tx.backlog_size) % SESSION_BACKLOG] =
+            addresses[i];
+        tx.backlog_size++;
+    }
+    return 1;
+}
+
+/**
+ * @brief Prepare an OFFER packet.
+ *
+ * bytes 0-1: destination address
+ * byte 2: number of messages we have for it, saturated at 255
+ * byte 3: data channel proposed
+ */
+static void prepare_offer(void)
+{
+    uint8_t *body = tx_buffer + HEADER_SIZE;
+    fifo_put_header(OFFER, 4);
+    *((uint16_t *) body) = tx.peer;
+    body[2] = tx.backlog_size > 255 ? 255 : tx.backlog_size;
+    body[3] = channel_propose(neighbour_fast(tx.peer),
+                              neighbour_fec(tx.peer));
+}
+
+/**
+ * @brief Prepare a SINCE packet, and move to the data channel it proposes
+ * once it is sent.
+ *
+ * bytes 0-1: destination address
+ * bytes 2-5: oldest emission date wanted
+ * byte 6: data channel proposed, or CHANNEL_RENDEZVOUS to stay where we are
+ */
+static void prepare_since(void)
+{
+    uint8_t *body = tx_buffer + HEADER_SIZE;
+    fifo_put_header(SINCE, 7);
+    *((uint16_t *) body) = rx.peer;
+    *((uint32_t *) (body + 2)) = rx.since;
+
+    // The previous one got no answer: send it where we met the peer.
+    rx_leave();
+    uint8_t channel = channel_propose(neighbour_fast(rx.peer),
+                                      neighbour_fec(rx.peer));
+    rx.joined = channel_join(channel, 1);
+    body[6]   = rx.joined ? channel : CHANNEL_RENDEZVOUS;
+}
+
+/**
+ * @brief Prepare an ACCEPT or an ACK packet. After an ACCEPT, we move to the
+ * data channel proposed by the OFFER, if we can, at the slow rate or coded if
+ * the link is not good enough for it.
+ *
+ * ACCEPT:
+ * bytes 0-1: destination address
+ * byte 2: data channel to use, or CHANNEL_RENDEZVOUS to stay where we are
+ *
+ * ACK:
+ * bytes 0-1: destination address
+ * byte 2: oldest sequence number not received
+ * byte 3: bitmap of the following ones received, bit i for base + i
+ */
+static void prepare_ack(void)
+{
+    uint8_t *body = tx_buffer + HEADER_SIZE;
+    *((uint16_t *) body) = rx.peer;
+
+    if(rx.state == SESSION_OFFERED) {
+        fifo_put_header(ACCEPT, 3);
+        rx.state  = SESSION_ACTIVE;
+        rx.channel = channel_robust(rx.channel, neighbour_fast(rx.peer),
+                                    neighbour_fec(rx.peer));
+        rx.joined = channel_join(rx.channel, 1);
+        body[2]   = rx.joined ? rx.channel : CHANNEL_RENDEZVOUS;
+    } else {
+        fifo_put_header(ACK, 4);
+        body[2] = rx.base;
+        body[3] = rx.received;
+    }
+
+    rx.pending   = 0;
+    rx.since_ack = 0;
+}
+
+/**
+ * @brief Prepare a DATA packet.
+ *
+ * bytes 0-1: destination address
+ * byte 2: sequence number
+ * bytes 3+: the message, as in a MESSAGE packet, if it has not been erased
+ *
+ * @param seq The sequence number of the packet.
+ */
+static void prepare_data(uint8_t seq)
+{
+    uint8_t *body = tx_buffer + HEADER_SIZE;
+    *((uint16_t *) body) = tx.peer;
+    body[2] = seq;
+    uint16_t address = tx.window[seq % SESSION_WINDOW];
+    uint8_t  length  = 0;
+    if(address != END_REACHED)
+        length = fifo_put_message(body + DATA_HEADER_SIZE, address);
+    fifo_put_header(DATA, DATA_HEADER_SIZE + length);
+}
+
+/**
+ * @brief Prepare the next packet of the receiving session, if any.
+ *
+ * @param now The current system time.
+ *
+ * @return 1 if a packet has been put in tx_buffer, 0 if not.
+ */
+static int rx_pop(systime_t now)
+{
+    if(rx.state == SESSION_IDLE)
+        return 0;
+
+    if(rx.state == SESSION_SINCE) {
+        if(rx.retries && (systime_t) (now - rx.last) < SESSION_ACK_TIMEOUT)
+            return 0;
+        if(rx.retries == SESSION_RETRIES) {
+            // The neighbour does not answer, the descent will do.
+            rx.state = SESSION_IDLE;
+            rx_leave();
+            return 0;
+        }
+        rx.retries++;
+        rx.last = now;
+        prepare_since();
+        return 1;
+    }
+
+    if((systime_t) (now - rx.last) >= SESSION_IDLE_TIMEOUT) {
+        rx.state = SESSION_IDLE;
+        rx_leave();
+        return 0;
+    }
+
+    // The sender is done, or has gone back to the rendezvous channel.
+    if(rx.joined && (systime_t) (now - rx.last) >= CHANNEL_LINGER)
+        rx_leave();
+
+    // ACK right away if something is missing, or if enough packets arrived.
+    // Otherwise, wait until the sender pauses.
+    int fresh = rx.fresh;
+    rx.fresh = 0;
+    unless(rx.pending)
+        return 0;
+    if(rx.state == SESSION_ACTIVE && fresh && !rx.received
+            && rx.since_ack < SESSION_ACK_EVERY)
+        return 0;
+
+    prepare_ack();
+    return 1;
+}
+
+/**
+ * @brief Prepare the next packet of the sending session, if any.
+ *
+ * @param now The current system time.
+ *
+ * @return 1 if a packet has been put in tx_buffer, 0 if not.
+ */
+static int tx_pop(systime_t now)
+{
+    if(tx.state == SESSION_OFFERED) {
+        if((systime_t) (now - tx.deadline) >= SESSION_ACK_TIMEOUT
+                || tx.retries == 0) {
+            if(tx.retries == SESSION_RETRIES) {
+                // The neighbour does not answer, go back to broadcast.
+                tx_abort();
+                return 0;
+            }
+            tx.retries++;
+            tx.deadline = now;
+            prepare_offer();
+            return 1;
+        }
+        return 0;
+    }
+
+    unless(tx.state == SESSION_ACTIVE)
+        return 0;
+
+    tx_fill();
+
+    uint8_t outstanding = (uint8_t) (tx.next - tx.base);
+    unless(outstanding) {
+        // Everything has been acknowledged.
+        tx.state = SESSION_IDLE;
+        tx_leave();
+        return 0;
+    }
+
+    unless(tx.to_send) {
+        if((systime_t) (now - tx.deadline) < SESSION_ACK_TIMEOUT)
+            return 0;
+        if(tx.retries == SESSION_RETRIES) {
+            tx_abort();
+            return 0;
+        }
+        // Nothing acknowledged for too long: send the whole window again.
+        tx.retries++;
+        tx.to_send = ((1 << outstanding) - 1) & ~tx.acked;
+        neighbour_delivery(tx.peer, 0, __builtin_popcount(tx.to_send));
+    }
+
+    uint8_t i = 0;
+    while(!(tx.to_send & (1 << i)))
+        i++;
+    tx.to_send &= ~(1 << i);
+    tx.deadline = now;
+    prepare_data(tx.base + i);
+    return 1;
+}
+
+void session_forget(uint16_t address)
+{
+    int kept = 0;
+    for(int i = 0; i < tx.backlog_size; i++) {
+        uint16_t a = tx.backlog[(tx.backlog_head + i) % SESSION_BACKLOG];
+        if(a != address)
+            tx.backlog[(tx.backlog_head + kept++) % SESSION_BACKLOG] = a;
+    }
+    tx.backlog_size = kept;
+
+    for(uint8_t s = tx.base; s != tx.next; s++)
+        if(tx.window[s % SESSION_WINDOW] == address)
+            tx.window[s % SESSION_WINDOW] = END_REACHED;
+
+    // Its links are about to be lost: walk on from the next one.
+    if(tx.since_on && tx.cursor == address) {
+        tx.cursor = tree_next_emitted(address, tx.since);
+        tx.ahead  = 1;
+    }
+}
+
+int session_pop(void)
+{
+    systime_t now = chTimeNow();
+
+    // The receiving side first, since the sender is waiting for it.
+    return rx_pop(now) || tx_pop(now);
+}
+
+int session_request(uint16_t peer, uint32_t since)
+{
+    systime_t now = chTimeNow();
+
+    if(rx.state != SESSION_IDLE && rx.peer != peer
+            && (systime_t) (now - rx.last) < SESSION_IDLE_TIMEOUT)
+        return 0;
+
+    rx_leave();
+    rx.peer      = peer;
+    rx.state     = SESSION_SINCE;
+    rx.base      = 0;
+    rx.received  = 0;
+    rx.since_ack = 0;
+    rx.pending   = 0;
+    rx.fresh     = 0;
+    rx.retries   = 0;
+    rx.last      = now;
+    rx.since     = since;
+    return 1;
+}
+
+int session_receiving(uint16_t peer)
+{
+    return rx.state != SESSION_IDLE && rx.peer == peer
+        && (systime_t) (chTimeNow() - rx.last) < SESSION_IDLE_TIMEOUT;
+}
+
+void session_handle_since(uint16_t source, const void *buf, uint8_t length)
+{
+    // Neighbours are taking a data channel.
+    unless(((uint16_t *) buf)[0] == node_address) {
+        if(length >= 7)
+            channel_busy(((uint8_t *) buf)[6]);
+        return;
+    }
+    if(tx.state != SESSION_IDLE && tx.peer != source)
+        return;
+
+    // The request stands for an ACCEPT, start sending right away.
+    if(tx.state == SESSION_IDLE)
+        tx_open(source, SESSION_ACTIVE);
+    else if(tx.state == SESSION_OFFERED) {
+        tx.state    = SESSION_ACTIVE;
+        tx.retries  = 0;
+        tx.deadline = chTimeNow();
+    }
+
+    // The requester waits on the data channel it proposed. Opening the
+    // session clears joined, so join afterwards.
+    if(length >= 7 && !tx.joined)
+        tx.joined = channel_join(((uint8_t *) buf)[6], 0);
+
+    tx.since_on = 1;
+    tx.cursor   = END_REACHED;
+    tx.ahead    = 0;
+    tx.since    = ((uint32_t *) (((uint8_t *) buf) + 2))[0];
+}
+
+void session_handle_offer(uint16_t source, const void *buf, uint8_t length)
+{
+    unless(((uint16_t *) buf)[0] == node_address) {
+        if(length >= 4)
+            channel_busy(((uint8_t *) buf)[3]);
+        return;
+    }
+
+    systime_t now = chTimeNow();
+
+    // We already receive from someone else.
+    if(rx.state != SESSION_IDLE && rx.peer != source
+            && (systime_t) (now - rx.last) < SESSION_IDLE_TIMEOUT)
+        return;
+
+    rx_leave();
+    rx.peer      = source;
+    rx.state     = SESSION_OFFERED;
+    rx.channel   = length >= 4 ? ((uint8_t *) buf)[3] : CHANNEL_RENDEZVOUS;
+    rx.base      = 0;
+    rx.received  = 0;
+    rx.since_ack = 0;
+    rx.pending   = 1;
+    rx.fresh     = 0;
+    rx.last      = now;
+}
+
+void session_handle_accept(uint16_t source, const void *buf, uint8_t length)
+{
+    unless(((uint16_t *) buf)[0] == node_address) {
+        if(length >= 3)
+            channel_busy(((uint8_t *) buf)[2]);
+        return;
+    }
+    unless(tx.state == SESSION_OFFERED && tx.peer == source)
+        return;
+
+    // The receiver has moved to the data channel.
+    if(length >= 3)
+        tx.joined = channel_join(((uint8_t *) buf)[2], 0);
+
+    tx.state    = SESSION_ACTIVE;
+    tx.retries  = 0;
+    tx.deadline = chTimeNow();
+}
+
+void session_handle_data(uint16_t source, const void *buf)
+{
+    unless(((uint16_t *) buf)[0] == node_address)
+        return;
+    unless(rx.state != SESSION_IDLE && rx.peer == source)
+        return;
+
+    if(rx.joined)
+        channel_active();
+
+    // Our ACCEPT has been lost, but the sender went on anyway.
+    rx.state   = SESSION_ACTIVE;
+    rx.last    = chTimeNow();
+    rx.pending = 1;
+    rx.fresh   = 1;
+
+    uint8_t offset = ((uint8_t *) buf)[2] - rx.base;
+    if(offset >= SESSION_WINDOW)
+        // Already received: our ACK has been lost, send it again.
+        return;
+
+    rx.received |= 1 << offset;
+    while(rx.received & 1) {
+        rx.received >>= 1;
+        rx.base++;
+    }
+    rx.since_ack++;
+}
+
+void session_handle_ack(uint16_t source, const void *buf)
+{
+    unless(((uint16_t *) buf)[0] == node_address)
+        return;
+    unless(tx.state == SESSION_ACTIVE && tx.peer == source)
+        return;
+
+    uint8_t base     = ((uint8_t *) buf)[2];
+    uint8_t received = ((uint8_t *) buf)[3];
+    uint8_t shift    = base - tx.base;
+
+    // An ACK older than the window, or acknowledging what we did not send.
+    if(shift > (uint8_t) (tx.next - tx.base))
+        return;
+
+    // The packets acknowledged for the first time.
+    uint8_t delivered = shift
+                      - __builtin_popcount(tx.acked & ((1 << shift) - 1))
+                      + __builtin_popcount(received & ~(tx.acked >> shift));
+
+    if(tx.joined)
+        channel_active();
+
+    // Slide the window.
+    tx.base     = base;
+    tx.acked    = (tx.acked >> shift) | received;
+    tx.to_send  = (tx.to_send >> shift) & ~tx.acked;
+    tx.retries  = 0;
+    tx.deadline = chTimeNow();
+
+    // The packets before the last one received have been lost.
+    uint8_t lost = 0;
+    if(received) {
+        uint8_t last = 7;
+        while(!(received & (1 << last)))
+            last--;
+        uint8_t missing = ((1 << last) - 1) & ~tx.acked & ~tx.to_send;
+        lost = __builtin_popcount(missing);
+        tx.to_send |= missing;
+    }
+
+    // Tell how the link is doing, to choose the rate of the next sessions.
+    neighbour_delivery(tx.peer, delivered, lost);
+}
@@ -138,9 +138,11 @@ static uint16_t place_message(struct Bucket *b)
     if(result == HAS_BUCKET)
         return HAS_BUCKET;
 
-    update_leaf(id);
+    // Local messages do not change the hash of their list.
+    unless(b->state & BUCKET_LOCAL)
+        update_leaf(id);
 
-    return id;
+    return result;
 }
 
 // The structure of the tree is the following: there is a root node with
@@ -160,14 +162,15 @@ void build_tree(void)
 uint16_t tree_insert(struct Bucket *b)
 {
     chMtxLock(&tree_mtx);
-    uint16_t id = place_message(b);
-    if(id == MEM_FULL) {
+    uint16_t address = place_message(b);
+    if(address == MEM_FULL) {
         chMtxUnlock();
         return MEM_FULL;
     }
-    update_branch(id);
+    unless(b->state & BUCKET_LOCAL)
+        update_branch(small_id(b->type.id));
     chMtxUnlock();
-    return id;
+    return address;
 }
 
 #ifdef __MEMTESTS__
@@ -246,7 +249,7 @@ uint64_t get_leaf_hash(uint16_t leaf)
     return tree[NNODES + leaf];
 }
 
-int get_list(uint16_t leaf, uint64_t *buffer)
+int get_list(uint16_t leaf, uint8_t *buffer)
 {
     chMtxLock(&tree_mtx);
     int length = 0;
@@ -258,68 +261,174 @@ int get_list(uint16_t leaf, uint64_t *buffer)
     }
 
     while (address != NO_BUCKET) {
-        buffer[length] = BUCKET_READ_FIELD(address, type.id, 64);
+        unless(BUCKET_READ_FIELD(address, state, 8) & BUCKET_LOCAL) {
+            uint64_t id = BUCKET_READ_FIELD(address, type.id, 64);
+            memcpy(buffer + 8 * length++, &id, 8);
+        }
         address = BUCKET_READ_FIELD(address, next_id, 16);
-        length++;
     }
 
     chMtxUnlock();
     return length;
 }
 
-uint8_t cmp_lists(uint16_t leaf, void *buf, uint8_t length)
+uint8_t cmp_lists(uint16_t leaf, const void *buf, uint8_t length,
+                  uint16_t *out)
 {
     chMtxLock(&tree_mtx);
-    uint16_t b = memory_get_ids_head(leaf);
+    uint16_t b = memory_skip_local(memory_get_ids_head(leaf));
     if (b == NO_BUCKET) {
         chMtxUnlock();
         return 0;
     }
-    uint64_t hash = BUCKET_READ_FIELD(b, type.id, 64);
     uint8_t nb_to_send = 0;
 
+    // Both lists are sorted by increasing ids.
+    // The packet is not aligned: copy the distant hashes one by one.
     unsigned int i = 0;
-    while(b != NO_NEXT && i < length)
-        if(hash == ((uint64_t *) buf)[i+1]) {
-            b = BUCKET_READ_FIELD(b, next_id, 16);
+    while(b != NO_NEXT && i < length && nb_to_send < LIST_SEND_MAX) {
+        uint64_t hash = BUCKET_READ_FIELD(b, type.id, 64);
+        uint64_t distant;
+        memcpy(&distant, (const uint8_t *) buf + 8 * (i + 1), 8);
+        if(hash == distant) {
+            b = memory_skip_local(BUCKET_READ_FIELD(b, next_id, 16));
             i++;
-        } else if(BUCKET_READ_FIELD(b, type.id, 64) < ((uint64_t *) buf)[i+1]){
+        } else if(hash > distant) {
+            // The distant list has a message we do not have.
             i++;
         } else {
-            ((uint16_t *) buf)[nb_to_send++] = b;
-            b = BUCKET_READ_FIELD(b, next_id, 16);
+            out[nb_to_send++] = b;
+            b = memory_skip_local(BUCKET_READ_FIELD(b, next_id, 16));
         }
+    }
 
-    while(b != NO_NEXT) {
-        ((uint16_t *) buf)[nb_to_send++] = b;
-        b = BUCKET_READ_FIELD(b, next_id, 16);
+    while(b != NO_NEXT && nb_to_send < LIST_SEND_MAX) {
+        out[nb_to_send++] = b;
+        b = memory_skip_local(BUCKET_READ_FIELD(b, next_id, 16));
     }
 
     chMtxUnlock();
     return nb_to_send;
 }
 
+/**
+ * @brief Look for a message in its id list.
+ *
+ * @param id The id of the message.
+ *
+ * @return The address of the bucket, or NO_BUCKET if it is not in memory.
+ */
+static uint16_t find_message(uint64_t id)
+{
+    uint16_t position = memory_get_ids_head(small_id(id));
+
+    // The lists are sorted by increasing ids.
+    while(position != NO_BUCKET) {
+        uint64_t hash = BUCKET_READ_FIELD(position, type.id, 64);
+        if(hash == id)
+            return position;
+        if(hash > id)
+            break;
+        position = BUCKET_READ_FIELD(position, next_id, 16);
+    }
+
+    return NO_BUCKET;
+}
+
 int tree_has_message(uint64_t id)
 {
     chMtxLock(&tree_mtx);
-    uint16_t leaf = small_id(id);
-    uint16_t position = memory_get_ids_head(leaf);
-    if(position == NO_BUCKET) {
-        chMtxUnlock();
-        return HAS_NOT;
+    uint16_t position = find_message(id);
+    chMtxUnlock();
+
+    if(position != NO_BUCKET)
+        return HAS;
+    return HAS_NOT;
+}
+
+uint16_t tree_find_message(uint64_t id)
+{
+    chMtxLock(&tree_mtx);
+    uint16_t position = find_message(id);
+    chMtxUnlock();
+
+    if(position == NO_BUCKET)
+        return END_REACHED;
+    return position;
+}
+
+uint16_t tree_peek_message(uint64_t id)
+{
+    unless(chMtxTryLock(&tree_mtx))
+        return END_REACHED;
+    uint16_t position = find_message(id);
+    chMtxUnlock();
+
+    if(position == NO_BUCKET)
+        return END_REACHED;
+    return position;
+}
+
+void tree_erase(uint16_t address)
+{
+    chMtxLock(&tree_mtx);
+    uint16_t leaf = small_id(BUCKET_READ_FIELD(address, type.id, 64));
+    uint8_t  state = BUCKET_READ_FIELD(address, state, 8);
+    memory_erase_bucket(address);
+    unless(state & BUCKET_LOCAL) {
+        update_leaf(leaf);
+        update_branch(leaf);
     }
-    uint64_t hash = BUCKET_READ_FIELD(position, type.id, 64);
+    chMtxUnlock();
+}
 
-    while((position != NO_BUCKET) && (id > hash)) {
-        hash = BUCKET_READ_FIELD(position, type.id, 64);
-        position = BUCKET_READ_FIELD(position, next_id, 16);
+uint16_t tree_evictable(int (*wanted)(uint16_t source, uint16_t destination),
+                        int scan)
+{
+    chMtxLock(&tree_mtx);
+    uint16_t address = memory_get_timestamps_head();
+    uint16_t victim  = NO_NEXT;
+    for(int i = 0; i < scan && address != NO_NEXT; i++) {
+        unless(wanted(BUCKET_READ_FIELD(address, source_address, 16),
+                      BUCKET_READ_FIELD(address, destination_address, 16))) {
+            victim = address;
+            break;
+        }
+        address = BUCKET_READ_FIELD(address, next_timestamp, 16);
     }
+    chMtxUnlock();
+
+    if(victim == NO_NEXT)
+        return END_REACHED;
+    return victim;
+}
 
+uint16_t tree_next_emitted(uint16_t address, uint32_t since)
+{
+    chMtxLock(&tree_mtx);
+    uint16_t next = (address == END_REACHED)
+        ? memory_get_emission_head()
+        : BUCKET_READ_FIELD(address, next_emission, 16);
+    while(next != NO_NEXT
+            && (BUCKET_READ_FIELD(next, state, 8) & BUCKET_LOCAL))
+        next = BUCKET_READ_FIELD(next, next_emission, 16);
+    if(next != NO_NEXT && BUCKET_READ_FIELD(next, emission_date, 32) < since)
+        next = NO_NEXT;
     chMtxUnlock();
 
-    if(id == hash)
-        return HAS;
-    return HAS_NOT;
+    if(next == NO_NEXT)
+        return END_REACHED;
+    return next;
+}
+
+uint32_t tree_last_emission(void)
+{
+    chMtxLock(&tree_mtx);
+    uint16_t head = memory_get_emission_head();
+    uint32_t date = (head == NO_BUCKET) ? 0
+                  : BUCKET_READ_FIELD(head, emission_date, 32);
+    chMtxUnlock();
+    return date;
 }
 
 void tree_reset(void)
@@ -341,8 +450,9 @@ void tree_reset(void)
  */
 static uint16_t id_next_message(uint16_t id, uint16_t start)
 {
-    for (int i = start ; i < 1024 ; i++)
-        if (BUCKET_READ_FIELD(i, destination_address, 16) == id)
+    for (int i = start ; i < MEM_SIZE ; i++)
+        if ((BUCKET_READ_FIELD(i, state, 8) & 0x01)
+                && BUCKET_READ_FIELD(i, destination_address, 16) == id)
             return i;
     return END_REACHED;
 }
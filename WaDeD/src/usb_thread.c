@@ -20,6 +20,12 @@
 #include "usb_thread.h"
 #include "client_cmd.h"
 #include "string_handler.h"
+#include "fifo.h"
+#include "neighbour.h"
+#include "route.h"
+#include "role.h"
+#include "receipt.h"
+#include "quota.h"
 #include <string.h>
 
 #define DAY_MS (24 * 60 * 60 * 1000)
@@ -27,6 +33,11 @@
 //USE_MEMORY
 static struct Bucket usb_buc;
 
+/**
+ * @brief Hop limit of the messages sent by the user.
+ */
+static uint8_t hop_limit = HOP_UNLIMITED;
+
 /**
  * @brief Set a bucket hash.
  * @param buc Pointer to the Bucket (other fields must be already set)
@@ -52,9 +63,15 @@ static void send_all_msgs(void){
 
     while (1){
         pos = next_message(host_id,pos,&usb_buc);
-        if (usb_buc.state)
-            send_usr_message(&usb_buc);
-        else break;
+        if (usb_buc.state) {
+            // Delivered, it is erased from the fifo and the memory.
+            if (send_usr_message(&usb_buc)) {
+                jungle_lock();
+                receipt_delivered(usb_buc.type.id,
+                                  usb_buc.expiration_date);
+                jungle_unlock();
+            }
+        } else break;
         pos++;
     }
 }
@@ -69,17 +86,68 @@ msg_t usb_thread(void *arg){
         switch(get_command(&usb_buc)){
             case SET_ID_ID:
                 host_id = usb_buc.source_address;
+                jungle_lock();
+                route_add(host_id);
+                jungle_unlock();
                 send_all_msgs();
                 break;
             case GET_ID_ID:
                 send_usr_id(host_id);
                 break;
+            case GET_POWER_ID: {
+                struct PowerStats stats;
+                power_stats(&stats);
+                send_usr_power(&stats);
+                break;
+            }
+            case GET_ROLE_ID:
+                send_usr_role(role_get());
+                break;
+            case GET_AIRTIME_ID:
+                send_usr_airtime();
+                break;
+            case SET_HOP_ID:
+                hop_limit = usb_buc.hop_limit;
+                break;
+            case SET_ROLE_ID:
+                jungle_lock();
+                role_set(usb_buc.type_id);
+                jungle_unlock();
+                usb_buc.type_id = 0;
+                break;
+            case SET_QUOTA_ID:
+                jungle_lock();
+                quota_set(usb_buc.source_address,
+                          usb_buc.destination_address);
+                jungle_unlock();
+                break;
             case SEND_TXT_ID:
                 usb_buc.source_address = host_id;
                 usb_buc.emission_date = get_timestamp();
                 usb_buc.expiration_date = usb_buc.emission_date + DAY_MS;
                 usb_buc.type.id = bucket_hash(&usb_buc);
-                tree_insert(&usb_buc);
+                usb_buc.hop_limit = hop_limit;
+                jungle_lock();
+                // A gateway flooding the network from its host is held to
+                // its quota as any other source.
+                if (!quota_admit(&usb_buc)) {
+                    jungle_unlock();
+                    break;
+                }
+                if (hop_limit == HOP_UNLIMITED) {
+                    usb_buc.state &= ~BUCKET_LOCAL;
+                    jungle_store(&usb_buc);
+                    neighbour_tree_changed();
+                    fifo_root_reset();
+                } else {
+                    // Scoped messages are pushed to the neighbours, as they
+                    // will not be found by the descents.
+                    usb_buc.state |= BUCKET_LOCAL;
+                    uint16_t address = jungle_store(&usb_buc);
+                    if (address != MEM_FULL)
+                        fifo_push(address, MESSAGE);
+                }
+                jungle_unlock();
                 break;
         }
     }